@@ -79,18 +79,10 @@ static void iv_getaddrinfo_task_work(void *_igt)
 			       igt->have_hints ? &igt->hints : NULL, &igt->res);
 }
 
-static void iv_getaddrinfo_task_complete(void *_igt)
+static void iv_getaddrinfo_task_free(struct iv_getaddrinfo_task *igt)
 {
-	struct iv_getaddrinfo_task *igt = _igt;
-	struct iv_getaddrinfo *ig;
 	struct iv_getaddrinfo_thr_info *tinfo;
 
-	ig = igt->ig;
-	if (ig != NULL)
-		ig->handler(ig->cookie, igt->ret, igt->res);
-	else
-		freeaddrinfo(igt->res);
-
 	free(igt->node);
 	free(igt->service);
 	free(igt);
@@ -100,6 +92,22 @@ static void iv_getaddrinfo_task_complete(void *_igt)
 		iv_work_pool_put(&tinfo->pool);
 }
 
+static void iv_getaddrinfo_task_complete(void *_igt)
+{
+	struct iv_getaddrinfo_task *igt = _igt;
+	struct iv_getaddrinfo *ig;
+
+	ig = igt->ig;
+	if (ig != NULL) {
+		ig->task = NULL;
+		ig->handler(ig->cookie, igt->ret, igt->res);
+	} else {
+		freeaddrinfo(igt->res);
+	}
+
+	iv_getaddrinfo_task_free(igt);
+}
+
 int iv_getaddrinfo_submit(struct iv_getaddrinfo *ig)
 {
 	struct iv_getaddrinfo_task *igt;
@@ -148,13 +156,28 @@ int iv_getaddrinfo_submit(struct iv_getaddrinfo *ig)
 
 	iv_work_pool_submit_work(&tinfo->pool, &igt->work);
 
+	ig->task = igt;
+
 	return 0;
 }
 
 void iv_getaddrinfo_cancel(struct iv_getaddrinfo *ig)
 {
 	struct iv_getaddrinfo_task *t = ig->task;
+	struct iv_getaddrinfo_thr_info *tinfo;
 
 	ig->task = NULL;
+
+	/*
+	 * If no pool thread has picked up the lookup yet, withdraw it
+	 * so that we don't block a thread on a result that nobody is
+	 * going to look at, otherwise just detach from it.
+	 */
+	tinfo = iv_tls_user_ptr(&iv_getaddrinfo_tls_user);
+	if (!iv_work_item_cancel(&tinfo->pool, &t->work)) {
+		iv_getaddrinfo_task_free(t);
+		return;
+	}
+
 	t->ig = NULL;
 }
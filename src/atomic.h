@@ -0,0 +1,69 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __ATOMIC_H
+#define __ATOMIC_H
+
+/*
+ * Minimal set of atomic operations on naturally aligned int-sized
+ * and pointer-sized variables.  We use the __atomic builtins where
+ * the compiler provides them, and fall back to the older __sync
+ * builtins (which always imply a full barrier) otherwise.
+ */
+#ifdef HAVE_ATOMIC_BUILTINS
+#define atomic_load_relaxed(p)		__atomic_load_n(p, __ATOMIC_RELAXED)
+#define atomic_load_acquire(p)		__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define atomic_store_relaxed(p, v)	__atomic_store_n(p, v, __ATOMIC_RELAXED)
+#define atomic_store_release(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define atomic_xchg(p, v)		__atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+#define atomic_fetch_add(p, v)		__atomic_fetch_add(p, v, __ATOMIC_SEQ_CST)
+#define atomic_cmpxchg(p, o, n)						\
+	__atomic_compare_exchange_n(p, o, n, 0, __ATOMIC_SEQ_CST,	\
+				    __ATOMIC_RELAXED)
+#define atomic_mb()			__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#define atomic_load_relaxed(p)		(*(volatile typeof(*(p)) *)(p))
+#define atomic_load_acquire(p)						\
+	({ typeof(*(p)) __v = atomic_load_relaxed(p);			\
+	   __sync_synchronize(); __v; })
+#define atomic_store_relaxed(p, v)					\
+	do { *(volatile typeof(*(p)) *)(p) = (v); } while (0)
+#define atomic_store_release(p, v)					\
+	do { __sync_synchronize(); atomic_store_relaxed(p, v); } while (0)
+#define atomic_xchg(p, v)						\
+	({ typeof(*(p)) __o;						\
+	   do { __o = atomic_load_relaxed(p); }				\
+	   while (!__sync_bool_compare_and_swap(p, __o, v)); __o; })
+#define atomic_fetch_add(p, v)		__sync_fetch_and_add(p, v)
+#define atomic_cmpxchg(p, o, n)						\
+	({ typeof(*(p)) __e = *(o);					\
+	   typeof(*(p)) __c = __sync_val_compare_and_swap(p, __e, n);	\
+	   *(o) = __c; __c == __e; })
+#define atomic_mb()			__sync_synchronize()
+#endif
+
+/*
+ * Used to keep data that is written by different threads in
+ * different cache lines.
+ */
+#define CACHE_LINE_SIZE			64
+
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __IV_CHANNEL_H
+#define __IV_CHANNEL_H
+
+#include <iv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct iv_channel {
+	int			max_msgs;
+	void			*cookie;
+	void			(*handler)(void *cookie, void **msgs, int num);
+
+	void			*priv;
+};
+
+static inline void IV_CHANNEL_INIT(struct iv_channel *this)
+{
+	this->max_msgs = 0;
+}
+
+int iv_channel_register(struct iv_channel *this);
+void iv_channel_unregister(struct iv_channel *this);
+int iv_channel_send(struct iv_channel *this, void *msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
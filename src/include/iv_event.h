@@ -43,6 +43,7 @@ static inline void IV_EVENT_INIT(struct iv_event *this)
 int iv_event_register(struct iv_event *this);
 void iv_event_unregister(struct iv_event *this);
 void iv_event_post(struct iv_event *this);
+void iv_event_post_many(struct iv_event **events, int num);
 
 #ifdef __cplusplus
 }
@@ -21,33 +21,130 @@
 #ifndef __IV_FD_PUMP_H
 #define __IV_FD_PUMP_H
 
+#include <iv.h>
+#include <iv_list.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct iv_fd_pump_group {
+	unsigned int		rate;
+	unsigned int		burst;
+
+	long long		credit;
+	struct timespec		last;
+	struct iv_timer		refill;
+	struct iv_list_head	waiting;
+};
+
+static inline void IV_FD_PUMP_GROUP_INIT(struct iv_fd_pump_group *this)
+{
+	this->burst = 0;
+}
+
+void iv_fd_pump_group_init(struct iv_fd_pump_group *this);
+void iv_fd_pump_group_destroy(struct iv_fd_pump_group *this);
+
+struct iv_fd_pump_stats {
+	unsigned long long	bytes_copied;
+	unsigned long long	bytes_spliced;
+	unsigned long long	syscalls;
+	unsigned long long	times_full;
+	unsigned long long	full_nsec;
+	unsigned long long	throttled_nsec;
+};
+
 struct iv_fd_pump {
-	int		from_fd;
-	int		to_fd;
-	void		*cookie;
-	void		(*set_bands)(void *cookie, int pollin, int pollout);
-	unsigned int	flags;
-
-	void		*buf;
-	int		bytes;
-	int		full;
-	int		saw_fin;
+	int			from_fd;
+	int			to_fd;
+	void			*cookie;
+	void			(*set_bands)(void *cookie, int pollin,
+					     int pollout);
+	unsigned int		flags;
+	int			buf_size;
+	unsigned int		rate;
+	unsigned int		burst;
+	struct iv_fd_pump_group	*group;
+
+	void			*buf;
+	int			bytes;
+	int			full;
+	int			saw_fin;
+	int			direct;
+	int			zerocopy;
+	unsigned int		zc_sent;
+	unsigned int		zc_done;
+	int			throttled;
+	long long		credit;
+	struct timespec		last;
+	struct iv_timer		refill;
+	struct iv_list_head	group_list;
+	struct iv_fd_pump_stats	stats;
+	struct timespec		full_since;
+	struct timespec		throttled_since;
+	struct iv_list_head	thr_list;
 };
 
 static inline void IV_FD_PUMP_INIT(struct iv_fd_pump *this)
 {
+	this->buf_size = 0;
+	this->rate = 0;
+	this->burst = 0;
+	this->group = NULL;
 }
 
 #define IV_FD_PUMP_FLAG_RELAY_EOF	1
+#define IV_FD_PUMP_FLAG_ZEROCOPY	2
 
 void iv_fd_pump_init(struct iv_fd_pump *ip);
 void iv_fd_pump_destroy(struct iv_fd_pump *ip);
 int iv_fd_pump_pump(struct iv_fd_pump *ip);
 int iv_fd_pump_is_done(const struct iv_fd_pump *ip);
+void iv_fd_pump_set_cache_size(int num_bufs);
+void iv_fd_pump_get_stats(const struct iv_fd_pump *ip,
+			  struct iv_fd_pump_stats *stats);
+void iv_fd_pump_get_thread_stats(struct iv_fd_pump_stats *stats);
+
+struct iv_fd_pump_tee_sink {
+	int			fd;
+	void			*cookie;
+	void			(*set_pollout)(void *cookie, int pollout);
+	void			(*dropped)(void *cookie);
+
+	void			*buf;
+	int			bytes;
+	int			active;
+};
+
+struct iv_fd_pump_tee {
+	int				from_fd;
+	void				*cookie;
+	void				(*set_pollin)(void *cookie,
+						      int pollin);
+	unsigned int			flags;
+	int				buf_size;
+	int				max_lag_msec;
+	struct iv_fd_pump_tee_sink	*sinks;
+	int				num_sinks;
+
+	void				*buf;
+	int				bytes;
+	int				saw_fin;
+	int				num_active;
+	struct iv_timer			lag_timer;
+};
+
+static inline void IV_FD_PUMP_TEE_INIT(struct iv_fd_pump_tee *this)
+{
+	this->buf_size = 0;
+	this->max_lag_msec = 0;
+}
+
+void iv_fd_pump_tee_init(struct iv_fd_pump_tee *t);
+void iv_fd_pump_tee_destroy(struct iv_fd_pump_tee *t);
+int iv_fd_pump_tee_pump(struct iv_fd_pump_tee *t);
+int iv_fd_pump_tee_is_done(const struct iv_fd_pump_tee *t);
 
 #ifdef __cplusplus
 }
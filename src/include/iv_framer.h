@@ -0,0 +1,75 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __IV_FRAMER_H
+#define __IV_FRAMER_H
+
+#include <sys/types.h>
+#include <iv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IV_FRAMER_TYPE_DELIM	0
+#define IV_FRAMER_TYPE_LENGTH	1
+
+struct iv_framer_record {
+	const void		*data;
+	size_t			len;
+};
+
+struct iv_framer {
+	int			fd;
+	void			*cookie;
+	void			(*handler_records)(void *cookie,
+					const struct iv_framer_record *recs,
+					int num);
+	void			(*handler_done)(void *cookie, int err);
+	int			type;
+	unsigned char		delim;
+	int			len_bytes;
+	int			buf_size;
+
+	struct iv_fd		ifd;
+	unsigned char		*buf;
+	int			start;
+	int			scan;
+	int			end;
+	int			*dead;
+};
+
+static inline void IV_FRAMER_INIT(struct iv_framer *this)
+{
+	this->type = IV_FRAMER_TYPE_DELIM;
+	this->delim = '\n';
+	this->len_bytes = 4;
+	this->buf_size = 0;
+}
+
+void iv_framer_register(struct iv_framer *this);
+void iv_framer_unregister(struct iv_framer *this);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
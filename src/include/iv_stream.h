@@ -0,0 +1,81 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __IV_STREAM_H
+#define __IV_STREAM_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <iv.h>
+#include <iv_list.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct iv_stream {
+	int			fd;
+	void			*cookie;
+	void			(*handler_in)(void *cookie);
+	void			(*handler_full)(void *cookie);
+	void			(*handler_drained)(void *cookie);
+	void			(*handler_error)(void *cookie, int err);
+	size_t			high_water;
+	size_t			low_water;
+	int			lowat;
+
+	struct iv_fd		ifd;
+	struct iv_task		flush;
+	struct iv_list_head	segs;
+	size_t			queued;
+	void			*spare;
+	int			sock;
+	int			blocked;
+	int			full;
+	int			error;
+};
+
+static inline void IV_STREAM_INIT(struct iv_stream *this)
+{
+	this->handler_in = NULL;
+	this->handler_full = NULL;
+	this->handler_drained = NULL;
+	this->handler_error = NULL;
+	this->high_water = 0;
+	this->low_water = 0;
+	this->lowat = 0;
+}
+
+void iv_stream_register(struct iv_stream *this);
+void iv_stream_unregister(struct iv_stream *this);
+void iv_stream_set_handler_in(struct iv_stream *this,
+			      void (*handler_in)(void *cookie));
+int iv_stream_write(struct iv_stream *this, const void *buf, size_t len);
+int iv_stream_writev(struct iv_stream *this,
+		     const struct iovec *iov, int iovcnt);
+int iv_stream_flush(struct iv_stream *this);
+size_t iv_stream_queued(const struct iv_stream *this);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
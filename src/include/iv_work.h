@@ -33,34 +33,119 @@ struct iv_work_pool {
 	void		*cookie;
 	void		(*thread_start)(void *cookie);
 	void		(*thread_stop)(void *cookie);
+	int		flags;
+	int		min_threads;
+	int		idle_timeout_msec;
+	int		max_queue_delay_usec;
+	int		*cpus;
+	int		num_cpus;
+	int		numa_node;
+	int		high_watermark;
+	int		low_watermark;
+	void		(*queue_full)(void *cookie);
+	void		(*queue_drained)(void *cookie);
 
 	void		*priv;
 };
 
+struct iv_work_loop {
+	void			*priv;
+};
+
 struct iv_work_item {
 	void			*cookie;
 	void			(*work)(void *cookie);
 	void			(*completion)(void *cookie);
+	int			priority;
+	struct timespec		deadline;
+	int			timed_out;
+	int			flags;
+	struct iv_work_loop	*completion_loop;
 
 	struct iv_list_head	list;
+	struct timespec		submitted;
+	void			*completion_sink;
+	void			*queue;
+};
+
+#define IV_WORK_ITEM_FLAG_INLINE_COMPLETION	1
+
+#define IV_WORK_POOL_FLAG_LIGHTWEIGHT	1
+#define IV_WORK_POOL_FLAG_HARD_LIMIT	2
+
+struct iv_work_parallel {
+	int			count;
+	int			min_chunk;
+	void			*cookie;
+	void			(*work)(void *cookie, int start, int end);
+	void			(*completion)(void *cookie);
+};
+
+struct iv_work_strand {
+	struct iv_work_pool	*pool;
+
+	void			*priv;
 };
 
 static inline void IV_WORK_POOL_INIT(struct iv_work_pool *this)
 {
 	this->thread_start = NULL;
 	this->thread_stop = NULL;
+	this->flags = 0;
+	this->min_threads = 0;
+	this->idle_timeout_msec = 0;
+	this->max_queue_delay_usec = 0;
+	this->cpus = NULL;
+	this->num_cpus = 0;
+	this->numa_node = -1;
+	this->high_watermark = 0;
+	this->low_watermark = 0;
+	this->queue_full = NULL;
+	this->queue_drained = NULL;
 }
 
 static inline void IV_WORK_ITEM_INIT(struct iv_work_item *this)
+{
+	this->priority = 0;
+	this->deadline.tv_sec = 0;
+	this->deadline.tv_nsec = 0;
+	this->timed_out = 0;
+	this->flags = 0;
+	this->completion_loop = NULL;
+}
+
+static inline void IV_WORK_PARALLEL_INIT(struct iv_work_parallel *this)
+{
+	this->min_chunk = 0;
+}
+
+static inline void IV_WORK_LOOP_INIT(struct iv_work_loop *this)
+{
+}
+
+static inline void IV_WORK_STRAND_INIT(struct iv_work_strand *this)
 {
 }
 
 int iv_work_pool_create(struct iv_work_pool *this);
 void iv_work_pool_put(struct iv_work_pool *this);
-void iv_work_pool_submit_work(struct iv_work_pool *this,
-			      struct iv_work_item *work);
+int iv_work_pool_submit_work(struct iv_work_pool *this,
+			     struct iv_work_item *work);
 void iv_work_pool_submit_continuation(struct iv_work_pool *this,
                                       struct iv_work_item *work);
+int iv_work_pool_submit_batch(struct iv_work_pool *this,
+			      struct iv_work_item **work, int num);
+int iv_work_item_cancel(struct iv_work_pool *this, struct iv_work_item *work);
+int iv_work_pool_submit_parallel(struct iv_work_pool *this,
+				 struct iv_work_parallel *par);
+
+int iv_work_loop_register(struct iv_work_loop *this);
+void iv_work_loop_unregister(struct iv_work_loop *this);
+
+int iv_work_strand_create(struct iv_work_strand *this);
+void iv_work_strand_put(struct iv_work_strand *this);
+void iv_work_strand_submit(struct iv_work_strand *this,
+			   struct iv_work_item *work);
 
 #ifdef __cplusplus
 }
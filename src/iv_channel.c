@@ -0,0 +1,234 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iv.h>
+#include <iv_channel.h>
+#include <iv_event.h>
+#include "iv_private.h"
+#include "atomic.h"
+
+#define IV_CHANNEL_DEFAULT_MSGS	256
+
+/* data structures **********************************************************/
+struct iv_channel_slot {
+	unsigned int		seq;
+	void			*msg;
+};
+
+/*
+ * The ring is a bounded multi-producer single-consumer queue, where
+ * each slot carries a sequence number that tells producers whether
+ * the slot is free and tells the consumer whether the slot has been
+ * filled.  Producers only ever contend on ->tail, and the consumer
+ * owns ->head, and those are kept in separate cache lines.
+ */
+struct iv_channel_priv {
+	/* consumer side  */
+	unsigned int		head;
+	unsigned int		mask;
+	struct iv_event		ev;
+	void			*cookie;
+	void			(*handler)(void *cookie, void **msgs, int num);
+	int			dispatching;
+	int			dead;
+	void			**batch;
+	char			pad0[CACHE_LINE_SIZE];
+
+	/* producer side  */
+	unsigned int		tail;
+	char			pad1[CACHE_LINE_SIZE];
+
+	/* shared  */
+	int			pending;
+	char			pad2[CACHE_LINE_SIZE];
+
+	struct iv_channel_slot	slots[0];
+};
+
+
+/* ring handling ************************************************************/
+static int iv_channel_enqueue(struct iv_channel_priv *priv, void *msg)
+{
+	struct iv_channel_slot *slot;
+	unsigned int pos;
+
+	pos = atomic_load_relaxed(&priv->tail);
+	while (1) {
+		unsigned int seq;
+		int diff;
+
+		slot = &priv->slots[pos & priv->mask];
+		seq = atomic_load_acquire(&slot->seq);
+
+		diff = (int)(seq - pos);
+		if (diff == 0) {
+			if (atomic_cmpxchg(&priv->tail, &pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = atomic_load_relaxed(&priv->tail);
+		}
+	}
+
+	slot->msg = msg;
+	atomic_store_release(&slot->seq, pos + 1);
+
+	return 0;
+}
+
+static int iv_channel_dequeue(struct iv_channel_priv *priv, void **msg)
+{
+	struct iv_channel_slot *slot;
+	unsigned int pos;
+
+	pos = priv->head;
+	slot = &priv->slots[pos & priv->mask];
+	if (atomic_load_acquire(&slot->seq) != pos + 1)
+		return 0;
+
+	*msg = slot->msg;
+	atomic_store_release(&slot->seq, pos + priv->mask + 1);
+	priv->head = pos + 1;
+
+	return 1;
+}
+
+
+/* consumer side ************************************************************/
+static void iv_channel_free(struct iv_channel_priv *priv)
+{
+	iv_event_unregister(&priv->ev);
+	free(priv->batch);
+	free(priv);
+}
+
+static void iv_channel_got_event(void *_priv)
+{
+	struct iv_channel_priv *priv = _priv;
+	int num;
+
+	/*
+	 * Clear ->pending before looking at the ring, so that a
+	 * producer that enqueues a message after we have stopped
+	 * dequeueing is guaranteed to post the event again.
+	 */
+	atomic_xchg(&priv->pending, 0);
+
+	num = 0;
+	while (num <= priv->mask && iv_channel_dequeue(priv, &priv->batch[num]))
+		num++;
+
+	if (!num)
+		return;
+
+	priv->dispatching = 1;
+	priv->handler(priv->cookie, priv->batch, num);
+	priv->dispatching = 0;
+
+	if (priv->dead) {
+		iv_channel_free(priv);
+		return;
+	}
+
+	/*
+	 * If we drained a full ring's worth of messages, there may
+	 * be more, but give other event sources a chance to run first.
+	 */
+	if (num > priv->mask && !atomic_xchg(&priv->pending, 1))
+		iv_event_post(&priv->ev);
+}
+
+int iv_channel_register(struct iv_channel *this)
+{
+	struct iv_channel_priv *priv;
+	unsigned int size;
+	unsigned int i;
+
+	size = IV_CHANNEL_DEFAULT_MSGS;
+	if (this->max_msgs > 0) {
+		size = 1;
+		while (size < (unsigned int)this->max_msgs)
+			size <<= 1;
+	}
+
+	priv = malloc(sizeof(*priv) + size * sizeof(struct iv_channel_slot));
+	if (priv == NULL)
+		return -1;
+
+	priv->batch = malloc(size * sizeof(void *));
+	if (priv->batch == NULL) {
+		free(priv);
+		return -1;
+	}
+
+	IV_EVENT_INIT(&priv->ev);
+	priv->ev.cookie = priv;
+	priv->ev.handler = iv_channel_got_event;
+	if (iv_event_register(&priv->ev)) {
+		free(priv->batch);
+		free(priv);
+		return -1;
+	}
+
+	priv->head = 0;
+	priv->mask = size - 1;
+	priv->cookie = this->cookie;
+	priv->handler = this->handler;
+	priv->dispatching = 0;
+	priv->dead = 0;
+	priv->tail = 0;
+	priv->pending = 0;
+	for (i = 0; i < size; i++)
+		priv->slots[i].seq = i;
+
+	this->priv = priv;
+
+	return 0;
+}
+
+void iv_channel_unregister(struct iv_channel *this)
+{
+	struct iv_channel_priv *priv = this->priv;
+
+	this->priv = NULL;
+
+	if (priv->dispatching)
+		priv->dead = 1;
+	else
+		iv_channel_free(priv);
+}
+
+
+/* producer side ************************************************************/
+int iv_channel_send(struct iv_channel *this, void *msg)
+{
+	struct iv_channel_priv *priv = this->priv;
+
+	if (iv_channel_enqueue(priv, msg))
+		return -1;
+
+	if (!atomic_xchg(&priv->pending, 1))
+		iv_event_post(&priv->ev);
+
+	return 0;
+}
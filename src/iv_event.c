@@ -20,16 +20,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <iv.h>
 #include <iv_event.h>
 #include <iv_event_raw.h>
 #include <iv_tls.h>
+#include <string.h>
 #include "iv_private.h"
 #include "iv_event_private.h"
 #include "mutex.h"
 
-static int iv_event_use_event_raw;
-
 static void __iv_event_run_pending_events(void *_st)
 {
 	struct iv_state *st = _st;
@@ -70,6 +70,13 @@ void iv_event_init(struct iv_state *st)
 {
 	st->event_count = 0;
 
+	/*
+	 * Until this thread's event loop tells us otherwise, assume
+	 * that it is blocked in the kernel and needs to be kicked.
+	 */
+	st->events_sleeping = 1;
+	st->events_use_raw = 0;
+
 	IV_TASK_INIT(&st->events_local);
 	st->events_local.cookie = st;
 	st->events_local.handler = __iv_event_run_pending_events;
@@ -90,7 +97,47 @@ void iv_event_deinit(struct iv_state *st)
 
 void iv_event_run_pending_events(void)
 {
-	__iv_event_run_pending_events(iv_get_state());
+	struct iv_state *st = iv_get_state();
+
+	iv_event_poll_done(st);
+	__iv_event_run_pending_events(st);
+}
+
+/*
+ * iv_event_poll_prepare() is called by the event loop just before
+ * it is about to block in the poll method, and iv_event_poll_done()
+ * as soon as it has returned from it.  While ->events_sleeping is
+ * clear, the event loop is guaranteed to look at ->events_pending
+ * again before blocking, and so iv_event_post() does not need to
+ * send a (potentially expensive) cross-thread wakeup.
+ *
+ * ->events_sleeping is only ever written by the owning thread, and
+ * only read by other threads while holding ->event_list_mutex.
+ */
+void iv_event_poll_prepare(struct iv_state *st)
+{
+	int pending;
+
+	if (!st->event_count || !is_mt_app())
+		return;
+
+	___mutex_lock(&st->event_list_mutex);
+	pending = !iv_list_empty(&st->events_pending);
+	if (!pending)
+		st->events_sleeping = 1;
+	___mutex_unlock(&st->event_list_mutex);
+
+	if (pending && !iv_task_registered(&st->events_local))
+		iv_task_register(&st->events_local);
+}
+
+void iv_event_poll_done(struct iv_state *st)
+{
+	if (st->events_sleeping) {
+		___mutex_lock(&st->event_list_mutex);
+		st->events_sleeping = 0;
+		___mutex_unlock(&st->event_list_mutex);
+	}
 }
 
 int iv_event_register(struct iv_event *this)
@@ -100,10 +147,16 @@ int iv_event_register(struct iv_event *this)
 	st->numobjs++;
 
 	if (!st->event_count++ && is_mt_app()) {
-		if (!iv_event_use_event_raw && event_rx_on(st))
-			iv_event_use_event_raw = 1;
-
-		if (iv_event_use_event_raw) {
+		/*
+		 * The choice of wakeup mechanism is made per thread,
+		 * as the poll method's ->event_rx_on() can fail for
+		 * one thread (e.g. when it runs out of file
+		 * descriptors) while other threads are already
+		 * being woken up through it.
+		 */
+		st->events_use_raw = !!event_rx_on(st);
+
+		if (st->events_use_raw) {
 			int ret;
 
 			ret = iv_event_raw_register(&st->events_kick);
@@ -132,7 +185,7 @@ void iv_event_unregister(struct iv_event *this)
 	}
 
 	if (!--st->event_count && is_mt_app()) {
-		if (iv_event_use_event_raw) {
+		if (st->events_use_raw) {
 			iv_event_raw_unregister(&st->events_kick);
 		} else {
 			event_rx_off(st);
@@ -142,31 +195,94 @@ void iv_event_unregister(struct iv_event *this)
 	st->numobjs--;
 }
 
+static void iv_event_kick(struct iv_state *dst, int kick)
+{
+	struct iv_state *me = iv_get_state();
+
+	if (dst == me) {
+		if (!iv_task_registered(&me->events_local))
+			iv_task_register(&me->events_local);
+	} else if (!kick) {
+		/*
+		 * The target thread is not blocked in its poll
+		 * method, and will see this event before it next
+		 * blocks, so there is no need to wake it up.
+		 */
+	} else if (dst->events_use_raw) {
+		iv_event_raw_post(&dst->events_kick);
+	} else {
+		event_send(dst);
+	}
+}
+
 void iv_event_post(struct iv_event *this)
 {
 	struct iv_state *dst = this->owner;
 	int post;
+	int kick;
 
 	post = 0;
+	kick = 0;
 
 	___mutex_lock(&dst->event_list_mutex);
 	if (iv_list_empty(&this->list)) {
-		if (iv_list_empty(&dst->events_pending))
+		if (iv_list_empty(&dst->events_pending)) {
 			post = 1;
+			kick = dst->events_sleeping;
+		}
 		iv_list_add_tail(&this->list, &dst->events_pending);
 	}
 	___mutex_unlock(&dst->event_list_mutex);
 
-	if (post) {
-		struct iv_state *me = iv_get_state();
+	if (post)
+		iv_event_kick(dst, kick);
+}
 
-		if (dst == me) {
-			if (!iv_task_registered(&me->events_local))
-				iv_task_register(&me->events_local);
-		} else if (iv_event_use_event_raw) {
-			iv_event_raw_post(&dst->events_kick);
-		} else {
-			event_send(dst);
+void iv_event_post_many(struct iv_event **events, int num)
+{
+	uint8_t done[num ? : 1];
+	int i;
+
+	memset(done, 0, num);
+
+	/*
+	 * Post all events that belong to the same thread under a
+	 * single acquisition of that thread's event list lock, and
+	 * wake up each target thread at most once.
+	 */
+	for (i = 0; i < num; i++) {
+		struct iv_state *dst;
+		int post;
+		int kick;
+		int j;
+
+		if (done[i])
+			continue;
+
+		dst = events[i]->owner;
+		post = 0;
+		kick = 0;
+
+		___mutex_lock(&dst->event_list_mutex);
+		for (j = i; j < num; j++) {
+			struct iv_event *ie = events[j];
+
+			if (done[j] || ie->owner != dst)
+				continue;
+			done[j] = 1;
+
+			if (iv_list_empty(&ie->list)) {
+				if (iv_list_empty(&dst->events_pending)) {
+					post = 1;
+					kick = dst->events_sleeping;
+				}
+				iv_list_add_tail(&ie->list,
+						 &dst->events_pending);
+			}
 		}
+		___mutex_unlock(&dst->event_list_mutex);
+
+		if (post)
+			iv_event_kick(dst, kick);
 	}
 }
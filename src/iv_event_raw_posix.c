@@ -26,6 +26,7 @@
 #include <iv_event_raw.h>
 #include <string.h>
 #include "iv_private.h"
+#include "atomic.h"
 
 #ifdef linux
 #include "eventfd-linux.h"
@@ -33,6 +34,26 @@
 #include "eventfd-stub.h"
 #endif
 
+/*
+ * Posts to an iv_event_raw object are coalesced by means of the
+ * ->pending flag, but that flag lives in process memory, and so we
+ * can't rely on it in a child process created by fork(2), as the
+ * child's copy of the flag is never cleared by the recipient.
+ */
+static int iv_event_raw_coalesce;
+
+static void iv_event_raw_child(void)
+{
+	iv_event_raw_coalesce = 0;
+}
+
+static void iv_event_raw_init(void) __attribute__((constructor));
+static void iv_event_raw_init(void)
+{
+	if (!pthr_atfork(NULL, NULL, iv_event_raw_child))
+		iv_event_raw_coalesce = 1;
+}
+
 
 static void iv_event_raw_got_event(void *_this)
 {
@@ -59,6 +80,14 @@ static void iv_event_raw_got_event(void *_this)
 		return;
 	}
 
+	/*
+	 * Clear the pending flag before running the handler, so that
+	 * any post that happens from here on will cause another
+	 * wakeup, while posts that happened before this point are
+	 * covered by the handler invocation below.
+	 */
+	atomic_xchg(&this->pending, 0);
+
 	this->handler(this->cookie);
 }
 
@@ -92,6 +121,7 @@ int iv_event_raw_register(struct iv_event_raw *this)
 	iv_fd_register(&this->event_rfd);
 
 	this->event_wfd = fd[1];
+	this->pending = 0;
 	if (!eventfd_in_use) {
 		iv_fd_set_cloexec(fd[1]);
 		iv_fd_set_nonblock(fd[1]);
@@ -109,10 +139,19 @@ void iv_event_raw_unregister(struct iv_event_raw *this)
 		close(this->event_wfd);
 }
 
-void iv_event_raw_post(const struct iv_event_raw *this)
+void iv_event_raw_post(struct iv_event_raw *this)
 {
 	int ret;
 
+	/*
+	 * If a wakeup is already pending and hasn't been consumed
+	 * yet, there is no need to write to the event fd again.  This
+	 * also keeps the pipe from filling up in the case where we are
+	 * not using eventfd.
+	 */
+	if (iv_event_raw_coalesce && atomic_xchg(&this->pending, 1))
+		return;
+
 	do {
 		if (!eventfd_in_use) {
 			ret = write(this->event_wfd, "", 1);
@@ -205,6 +205,8 @@ int iv_fd_poll_and_run(struct iv_state *st, const struct timespec *abs)
 		run_timers = method->poll(st, &active, abs);
 	}
 
+	iv_event_poll_done(st);
+
 	while (!iv_list_empty(&active)) {
 		struct iv_fd_ *fd;
 
@@ -26,7 +26,6 @@
 #include <sys/syscall.h>
 #include "eventfd-linux.h"
 #include "iv_private.h"
-#include "mutex.h"
 
 static int epoll_support = 2;
 
@@ -76,6 +75,7 @@ static int iv_fd_epoll_init(struct iv_state *st)
 	INIT_IV_LIST_HEAD(&st->u.epoll.notify);
 	st->u.epoll.epoll_fd = fd;
 	st->u.epoll.timer_fd = -1;
+	st->u.epoll.event_fd = -1;
 
 	return 0;
 }
@@ -178,6 +178,23 @@ static int iv_fd_epoll_wait(struct iv_state *st, struct epoll_event *events,
 	return epoll_wait(epfd, events, maxevents, to_msec(st, abs));
 }
 
+static void iv_fd_epoll_event_rx(struct iv_state *st)
+{
+	uint64_t cnt;
+	int ret;
+
+	do {
+		ret = read(st->u.epoll.event_fd, &cnt, sizeof(cnt));
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0 && errno != EAGAIN) {
+		iv_fatal("iv_fd_epoll_event_rx: eventfd read returned "
+			 "error %d[%s]", errno, strerror(errno));
+	}
+
+	iv_event_run_pending_events();
+}
+
 static int iv_fd_epoll_poll(struct iv_state *st,
 			    struct iv_list_head *active,
 			    const struct timespec *abs)
@@ -224,7 +241,7 @@ static int iv_fd_epoll_poll(struct iv_state *st,
 	}
 
 	if (run_events)
-		iv_event_run_pending_events();
+		iv_fd_epoll_event_rx(st);
 
 	return 1;
 }
@@ -254,65 +271,42 @@ static void iv_fd_epoll_deinit(struct iv_state *st)
 	close(st->u.epoll.epoll_fd);
 }
 
-static int iv_fd_epoll_create_active_fd(void)
+static int iv_fd_epoll_event_rx_on(struct iv_state *st)
 {
+	struct epoll_event event;
 	int fd;
 	int ret;
 
+	/*
+	 * Each thread gets its own eventfd to be woken up through,
+	 * so that cross-thread wakeups to different threads do not
+	 * contend on a single shared file, and so that waking up a
+	 * thread is a plain eventfd write rather than an epoll_ctl()
+	 * on the target thread's epoll instance.
+	 */
 	fd = eventfd_grab();
-	if (fd >= 0) {
-		uint64_t one = 1;
-
-		ret = write(fd, &one, sizeof(one));
-		if (ret < 0) {
-			iv_fatal("iv_fd_epoll_create_active_fd: eventfd "
-				 "write returned error %d[%s]", errno,
-				 strerror(errno));
-		} else if (ret != sizeof(one)) {
-			iv_fatal("iv_fd_epoll_create_active_fd: eventfd "
-				 "write returned %d", ret);
-		}
-	} else {
-		int pfd[2];
-
-		if (pipe(pfd) < 0) {
-			iv_fatal("iv_fd_epoll_create_active_fd: pipe() "
-				 "returned error %d[%s]", errno,
-				 strerror(errno));
-		}
-
-		fd = pfd[0];
-		close(pfd[1]);
-	}
-
-	return fd;
-}
-
-static ___mutex_t iv_fd_epoll_active_fd_mutex = PTHREAD_MUTEX_INITIALIZER;
-static int iv_active_fd_refcount;
-static int iv_active_fd;
-
-static int iv_fd_epoll_event_rx_on(struct iv_state *st)
-{
-	struct epoll_event event;
-	int ret;
+	if (fd < 0)
+		return -1;
 
-	___mutex_lock(&iv_fd_epoll_active_fd_mutex);
-	if (!iv_active_fd_refcount++)
-		iv_active_fd = iv_fd_epoll_create_active_fd();
-	___mutex_unlock(&iv_fd_epoll_active_fd_mutex);
+	iv_fd_set_cloexec(fd);
+	iv_fd_set_nonblock(fd);
 
 	event.data.ptr = st;
-	event.events = 0;
+	event.events = EPOLLIN;
 	do {
 		ret = epoll_ctl(st->u.epoll.epoll_fd, EPOLL_CTL_ADD,
-				iv_active_fd, &event);
+				fd, &event);
 	} while (ret < 0 && errno == EINTR);
 
-	if (ret == 0)
-		st->numobjs++;
+	if (ret < 0) {
+		close(fd);
+		return ret;
+	}
 
-	return ret;
+	st->u.epoll.event_fd = fd;
+	st->numobjs++;
+
+	return 0;
 }
 
 static void iv_fd_epoll_event_rx_off(struct iv_state *st)
@@ -324,7 +318,7 @@ static void iv_fd_epoll_event_rx_off(struct iv_state *st)
 	event.events = 0;
 	do {
 		ret = epoll_ctl(st->u.epoll.epoll_fd, EPOLL_CTL_DEL,
-				iv_active_fd, &event);
+				st->u.epoll.event_fd, &event);
 	} while (ret < 0 && errno == EINTR);
 
 	if (ret < 0) {
@@ -332,28 +326,23 @@ static void iv_fd_epoll_event_rx_off(struct iv_state *st)
 			 "error %d[%s]", errno, strerror(errno));
 	}
 
-	___mutex_lock(&iv_fd_epoll_active_fd_mutex);
-	if (!--iv_active_fd_refcount)
-		close(iv_active_fd);
-	___mutex_unlock(&iv_fd_epoll_active_fd_mutex);
+	close(st->u.epoll.event_fd);
+	st->u.epoll.event_fd = -1;
 
 	st->numobjs--;
 }
 
 static void iv_fd_epoll_event_send(struct iv_state *dest)
 {
-	struct epoll_event event;
+	uint64_t one = 1;
 	int ret;
 
-	event.data.ptr = dest;
-	event.events = EPOLLIN | EPOLLONESHOT;
 	do {
-		ret = epoll_ctl(dest->u.epoll.epoll_fd, EPOLL_CTL_MOD,
-				iv_active_fd, &event);
+		ret = write(dest->u.epoll.event_fd, &one, sizeof(one));
 	} while (ret < 0 && errno == EINTR);
 
-	if (ret < 0) {
-		iv_fatal("iv_fd_epoll_event_send: epoll_ctl returned "
+	if (ret < 0 && errno != EAGAIN) {
+		iv_fatal("iv_fd_epoll_event_send: eventfd write returned "
 			 "error %d[%s]", errno, strerror(errno));
 	}
 }
@@ -514,7 +503,7 @@ static int iv_fd_epoll_timerfd_poll(struct iv_state *st,
 	}
 
 	if (run_events)
-		iv_event_run_pending_events();
+		iv_fd_epoll_event_rx(st);
 
 	return run_timers;
 }
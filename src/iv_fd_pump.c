@@ -21,35 +21,58 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <iv.h>
 #include <iv_fd_pump.h>
 #include <iv_list.h>
 #include <iv_tls.h>
+#include <stddef.h>
 #include <string.h>
+#include <netinet/in.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include "iv_private.h"
 
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
+
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
 /* thread state handling ****************************************************/
+#define DEFAULT_MAX_CACHED_BUFS	20
+
 struct iv_fd_pump_thr_info {
 	int			num_bufs;
+	int			max_bufs;
 	struct iv_list_head	bufs;
+	struct iv_fd_pump_stats	stats;
+	struct iv_list_head	pumps;
 };
 
-static void buf_purge(struct iv_fd_pump_thr_info *tinfo);
+static void buf_purge(struct iv_fd_pump_thr_info *tinfo, int keep);
 
 static void iv_fd_pump_tls_init_thread(void *_tinfo)
 {
 	struct iv_fd_pump_thr_info *tinfo = _tinfo;
 
 	tinfo->num_bufs = 0;
+	tinfo->max_bufs = DEFAULT_MAX_CACHED_BUFS;
 	INIT_IV_LIST_HEAD(&tinfo->bufs);
+	memset(&tinfo->stats, 0, sizeof(tinfo->stats));
+	INIT_IV_LIST_HEAD(&tinfo->pumps);
 }
 
 static void iv_fd_pump_tls_deinit_thread(void *_tinfo)
 {
 	struct iv_fd_pump_thr_info *tinfo = _tinfo;
 
-	buf_purge(tinfo);
+	buf_purge(tinfo, 0);
 }
 
 static struct iv_tls_user iv_fd_pump_tls_user = {
@@ -103,12 +126,12 @@ static int grab_pipe(int *fd)
 
 
 /* buffer management ********************************************************/
-#define MAX_CACHED_BUFS		20
-#define BUF_SIZE		4096
+#define DEFAULT_BUF_SIZE	65536
 
 #ifndef HAVE_SPLICE
  #define splice_available	 0
  #define splice(...)		-1
+ #define tee(...)		-1
  #ifndef FIONREAD
   #define FIONREAD		0
  #endif
@@ -116,54 +139,195 @@ static int grab_pipe(int *fd)
 static int splice_available = -1;
 #endif
 
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(SO_ZEROCOPY) && \
+    defined(MSG_ZEROCOPY)
+#define HAVE_ZEROCOPY
+#endif
+
+#define BUF_MEMORY		0
+#define BUF_PIPE		1
+#define BUF_ZEROCOPY		2
+
+#define ZC_MAX_SENDS		64
+
+/*
+ * In the splice case, the buffer is a pipe, and ->size is the pipe
+ * capacity that was asked for.  Pipes start out with a capacity of
+ * DEFAULT_BUF_SIZE bytes on Linux, and other sizes are requested
+ * with F_SETPIPE_SZ.  If that fails (for example because the size
+ * exceeds /proc/sys/fs/pipe-max-size for unprivileged users), the
+ * pipe is used with whatever capacity it has, but is still labeled
+ * with the requested size, so that the cache lookup for that size
+ * keeps finding it, and we don't retry the resize every time.
+ *
+ * In the non-splice case, the buffer is used as a ring buffer of
+ * ->size bytes, with the data starting at offset ->head and wrapping
+ * around at the end, so that partial writes don't require moving
+ * the remaining data around, and so that the free space and the
+ * queued data can each be described by (at most) two iovecs.
+ *
+ * The zerocopy case uses a ring buffer as well, but one that is
+ * mapped separately, as the data in it is sent with MSG_ZEROCOPY,
+ * and the kernel keeps referring to the pages that it was sent from
+ * until it signals the completion of the send on the socket error
+ * queue.  The ring then holds ->u.zc.inflight bytes of data that was
+ * sent but not yet completed starting at ->head, followed by the
+ * data that wasn't sent yet.  ->u.zc.len[] holds the length of each
+ * outstanding send, indexed by its notification ID, and is negated
+ * when the send completes.  A buffer that is released with sends
+ * still outstanding is unmapped rather than cached, so that its
+ * pages are never reused while the kernel might still transmit
+ * from them.
+ */
 struct iv_fd_pump_buf {
 	struct iv_list_head	list;
+	int			type;
+	int			size;
+	int			head;
 	union {
 		unsigned char	buf[0];
 		int		pfd[2];
+		struct {
+			unsigned char	*map;
+			int		inflight;
+			int		nobufs;
+			int		len[ZC_MAX_SENDS];
+		} zc;
 	} u;
 };
 
-static struct iv_fd_pump_buf *buf_alloc(void)
+static struct iv_fd_pump_buf *buf_alloc(int size, int type)
 {
-	int size;
 	struct iv_fd_pump_buf *buf;
 
-	if (!splice_available)
-		size = sizeof(struct iv_list_head) + BUF_SIZE;
+	if (type == BUF_MEMORY)
+		buf = malloc(offsetof(struct iv_fd_pump_buf, u) + size);
 	else
-		size = sizeof(struct iv_fd_pump_buf);
+		buf = malloc(sizeof(struct iv_fd_pump_buf));
+
+	if (buf == NULL)
+		return NULL;
 
-	buf = malloc(size);
+	if (type == BUF_PIPE) {
+		if (grab_pipe(buf->u.pfd) < 0) {
+			free(buf);
+			return NULL;
+		}
+
+#ifdef F_SETPIPE_SZ
+		if (size != DEFAULT_BUF_SIZE)
+			fcntl(buf->u.pfd[1], F_SETPIPE_SZ, size);
+#endif
+	} else if (type == BUF_ZEROCOPY) {
+		buf->u.zc.map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buf->u.zc.map == MAP_FAILED) {
+			free(buf);
+			return NULL;
+		}
 
-	if (buf != NULL && splice_available && grab_pipe(buf->u.pfd) < 0) {
-		free(buf);
-		buf = NULL;
+		buf->u.zc.inflight = 0;
+		buf->u.zc.nobufs = 0;
 	}
 
+	buf->type = type;
+	buf->size = size;
+	buf->head = 0;
+
 	return buf;
 }
 
 static void __buf_free(struct iv_fd_pump_buf *buf)
 {
-	if (splice_available) {
+	if (buf->type == BUF_PIPE) {
 		close(buf->u.pfd[0]);
 		close(buf->u.pfd[1]);
+	} else if (buf->type == BUF_ZEROCOPY) {
+		munmap(buf->u.zc.map, buf->size);
 	}
 	free(buf);
 }
 
+static unsigned char *buf_data(struct iv_fd_pump_buf *buf)
+{
+	return (buf->type == BUF_ZEROCOPY) ? buf->u.zc.map : buf->u.buf;
+}
+
+static int buf_inflight(const struct iv_fd_pump_buf *buf)
+{
+	return (buf->type == BUF_ZEROCOPY) ? buf->u.zc.inflight : 0;
+}
+
+/*
+ * Describe @len bytes of ring buffer @buf starting at offset @off
+ * in @iov, and return the number of iovecs used.
+ */
+static int buf_iov(struct iv_fd_pump_buf *buf, int off, int len,
+		   struct iovec *iov)
+{
+	unsigned char *data = buf_data(buf);
+
+	iov[0].iov_base = data + off;
+	if (off + len <= buf->size) {
+		iov[0].iov_len = len;
+		return 1;
+	}
+
+	iov[0].iov_len = buf->size - off;
+	iov[1].iov_base = data;
+	iov[1].iov_len = len - (buf->size - off);
+
+	return 2;
+}
+
+/*
+ * A pipe that still holds data can be reused after reading the data
+ * out of it, which is cheaper than closing it and creating a new one
+ * (and resizing that) as long as there isn't too much data left.
+ * The data is known to be there, so the reads won't block.
+ */
+#define MAX_DRAIN_BYTES		65536
+
+static int buf_drain(struct iv_fd_pump_buf *buf, int bytes)
+{
+	unsigned char scratch[4096];
+
+	if (bytes > MAX_DRAIN_BYTES)
+		return -1;
+
+	while (bytes) {
+		int ret;
+
+		ret = read(buf->u.pfd[0], scratch,
+			   bytes < sizeof(scratch) ? bytes : sizeof(scratch));
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		bytes -= ret;
+	}
+
+	return 0;
+}
+
 static void buf_put(struct iv_fd_pump_buf *buf, int bytes)
 {
 	struct iv_fd_pump_thr_info *tinfo;
 
-	if (splice_available && bytes) {
+	if (buf->type == BUF_PIPE && bytes && buf_drain(buf, bytes) < 0) {
+		__buf_free(buf);
+		return;
+	}
+
+	if (buf_inflight(buf)) {
 		__buf_free(buf);
 		return;
 	}
 
 	tinfo = iv_tls_user_ptr(&iv_fd_pump_tls_user);
-	if (tinfo->num_bufs < MAX_CACHED_BUFS) {
+	if (tinfo->num_bufs < tinfo->max_bufs) {
 		tinfo->num_bufs++;
 		iv_list_add(&buf->list, &tinfo->bufs);
 	} else {
@@ -178,15 +342,25 @@ static void check_splice_available(void)
 	struct iv_fd_pump_buf *b1;
 	int ret;
 
+	/*
+	 * Setting IV_FD_PUMP_NO_SPLICE forces the use of userspace
+	 * buffers, so that that code can be tested on hosts that
+	 * support splice(2).
+	 */
+	if (getenv("IV_FD_PUMP_NO_SPLICE") != NULL && getuid() == geteuid()) {
+		splice_available = 0;
+		return;
+	}
+
 	splice_available = 1;
 
-	b0 = buf_alloc();
+	b0 = buf_alloc(DEFAULT_BUF_SIZE, BUF_PIPE);
 	if (b0 == NULL) {
 		splice_available = 0;
 		return;
 	}
 
-	b1 = buf_alloc();
+	b1 = buf_alloc(DEFAULT_BUF_SIZE, BUF_PIPE);
 	if (b1 == NULL) {
 		__buf_free(b0);
 		splice_available = 0;
@@ -206,207 +380,1321 @@ static void check_splice_available(void)
 #endif
 }
 
-static struct iv_fd_pump_buf *__buf_dequeue(struct iv_fd_pump_thr_info *tinfo)
+/*
+ * Cached buffers can have different sizes and types, so take the
+ * first one of the requested size and type (or any buffer at all if
+ * @size is -1).
+ */
+static struct iv_fd_pump_buf *
+__buf_dequeue(struct iv_fd_pump_thr_info *tinfo, int size, int type)
 {
-	if (!iv_list_empty(&tinfo->bufs)) {
-		struct iv_list_head *ilh;
+	struct iv_list_head *ilh;
 
-		tinfo->num_bufs--;
+	iv_list_for_each (ilh, &tinfo->bufs) {
+		struct iv_fd_pump_buf *buf;
 
-		ilh = tinfo->bufs.next;
-		iv_list_del(ilh);
+		buf = iv_container_of(ilh, struct iv_fd_pump_buf, list);
+		if (size == -1 || (buf->size == size && buf->type == type)) {
+			tinfo->num_bufs--;
+			iv_list_del(&buf->list);
+			buf->head = 0;
 
-		return iv_container_of(ilh, struct iv_fd_pump_buf, list);
+			return buf;
+		}
 	}
 
 	return NULL;
 }
 
-static struct iv_fd_pump_buf *buf_get(void)
+static struct iv_fd_pump_buf *buf_get(int size, int type)
 {
 	struct iv_fd_pump_thr_info *tinfo =
 		iv_tls_user_ptr(&iv_fd_pump_tls_user);
 	struct iv_fd_pump_buf *buf;
 
-	buf = __buf_dequeue(tinfo);
+	buf = __buf_dequeue(tinfo, size, type);
 	if (buf == NULL)
-		buf = buf_alloc();
+		buf = buf_alloc(size, type);
 
 	return buf;
 }
 
-static void buf_purge(struct iv_fd_pump_thr_info *tinfo)
+static void buf_purge(struct iv_fd_pump_thr_info *tinfo, int keep)
 {
-	struct iv_fd_pump_buf *buf;
+	while (tinfo->num_bufs > keep)
+		__buf_free(__buf_dequeue(tinfo, -1, 0));
+}
 
-	while ((buf = __buf_dequeue(tinfo)) != NULL)
-		__buf_free(buf);
+void iv_fd_pump_set_cache_size(int num_bufs)
+{
+	struct iv_fd_pump_thr_info *tinfo =
+		iv_tls_user_ptr(&iv_fd_pump_tls_user);
+
+	if (num_bufs < 0)
+		num_bufs = DEFAULT_MAX_CACHED_BUFS;
+
+	tinfo->max_bufs = num_bufs;
+	buf_purge(tinfo, num_bufs);
 }
 
 
-/* iv_fd_pump ***************************************************************/
-static struct iv_fd_pump_buf *iv_fd_pump_buf(struct iv_fd_pump *ip)
+/* statistics ***************************************************************/
+/*
+ * Pumps only update their own counters.  The per-thread totals
+ * hold the counters of the pumps that were destroyed, and the
+ * counters of the pumps that are still around are added to those
+ * when they are asked for.
+ */
+static long long nsec_since(const struct timespec *since)
 {
-	return (struct iv_fd_pump_buf *)ip->buf;
+	return (iv_now.tv_sec - since->tv_sec) * 1000000000LL +
+		iv_now.tv_nsec - since->tv_nsec;
 }
 
-void iv_fd_pump_init(struct iv_fd_pump *ip)
+static void stats_add(struct iv_fd_pump_stats *dst,
+		      const struct iv_fd_pump_stats *src)
 {
-	if (splice_available == -1)
-		check_splice_available();
+	dst->bytes_copied += src->bytes_copied;
+	dst->bytes_spliced += src->bytes_spliced;
+	dst->syscalls += src->syscalls;
+	dst->times_full += src->times_full;
+	dst->full_nsec += src->full_nsec;
+	dst->throttled_nsec += src->throttled_nsec;
+}
 
-	ip->buf = NULL;
-	ip->bytes = 0;
-	ip->full = 0;
-	ip->saw_fin = 0;
+void iv_fd_pump_get_stats(const struct iv_fd_pump *ip,
+			  struct iv_fd_pump_stats *stats)
+{
+	*stats = ip->stats;
+
+	if (ip->full)
+		stats->full_nsec += nsec_since(&ip->full_since);
 
-	ip->set_bands(ip->cookie, 1, 0);
+	if (ip->throttled)
+		stats->throttled_nsec += nsec_since(&ip->throttled_since);
 }
 
-void iv_fd_pump_destroy(struct iv_fd_pump *ip)
+void iv_fd_pump_get_thread_stats(struct iv_fd_pump_stats *stats)
 {
-	struct iv_fd_pump_buf *buf = iv_fd_pump_buf(ip);
+	struct iv_fd_pump_thr_info *tinfo =
+		iv_tls_user_ptr(&iv_fd_pump_tls_user);
+	struct iv_list_head *ilh;
 
-	if (ip->saw_fin != 2)
-		ip->set_bands(ip->cookie, 0, 0);
+	*stats = tinfo->stats;
 
-	if (buf != NULL) {
-		buf_put(buf, ip->bytes);
-		ip->buf = NULL;
+	iv_list_for_each (ilh, &tinfo->pumps) {
+		struct iv_fd_pump *ip;
+		struct iv_fd_pump_stats st;
+
+		ip = iv_container_of(ilh, struct iv_fd_pump, thr_list);
+		iv_fd_pump_get_stats(ip, &st);
+		stats_add(stats, &st);
 	}
 }
 
-static int iv_fd_pump_try_input(struct iv_fd_pump *ip)
+static void iv_fd_pump_set_full(struct iv_fd_pump *ip, int full)
 {
-	struct iv_fd_pump_buf *buf = iv_fd_pump_buf(ip);
-	int ret;
+	if (full && !ip->full) {
+		ip->stats.times_full++;
+		ip->full_since = iv_now;
+	} else if (!full && ip->full) {
+		ip->stats.full_nsec += nsec_since(&ip->full_since);
+	}
 
-	if (buf == NULL) {
-		buf = buf_get();
-		if (buf == NULL)
-			return -1;
+	ip->full = full;
+}
 
-		ip->buf = (void *)buf;
-	}
 
-	do {
-		if (!splice_available) {
-			ret = read(ip->from_fd, buf->u.buf + ip->bytes,
-				   BUF_SIZE - ip->bytes);
-		} else {
-			ret = splice(ip->from_fd, NULL, buf->u.pfd[1], NULL,
-				     1048576, SPLICE_F_NONBLOCK);
-		}
-	} while (ret < 0 && errno == EINTR);
+/* rate limiting ************************************************************/
+/*
+ * Pumps can be limited to ->rate bytes per second on their own,
+ * and/or share the rate of an iv_fd_pump_group, each with a token
+ * bucket that holds up to ->burst bytes (or a second's worth of
+ * data if ->burst is zero).  The credit in a bucket is kept in
+ * units of a byte per nanosecond, so that slow rates don't lose
+ * the fractional bytes that accrue between two refills.
+ *
+ * Bytes are charged as they are read, and reads are limited to the
+ * available credit.  If no credit is left, the pump stops asking
+ * for input, and an iv_timer resumes it once the bucket holds
+ * 1/REFILL_HZ seconds worth of data (or a full bucket, if that is
+ * smaller), so that a throttled pump is woken up at most REFILL_HZ
+ * times per second.  The pumps waiting for a group share a single
+ * timer, which wakes all of them up at once.
+ */
+#define NSEC_PER_SEC		1000000000LL
+#define REFILL_HZ		100
 
-	if (ret < 0) {
-		if (errno != EAGAIN)
-			return -1;
+static void iv_fd_pump_update_bands(struct iv_fd_pump *ip);
 
-		if (splice_available && ip->bytes) {
-			int bytes = 1;
+static long long bucket_depth(unsigned int rate, unsigned int burst)
+{
+	return (long long)(burst ? burst : rate) * NSEC_PER_SEC;
+}
 
-			ioctl(ip->from_fd, FIONREAD, &bytes);
-			if (bytes > 0)
-				ip->full = 1;
-		}
+static void bucket_refill(unsigned int rate, unsigned int burst,
+			  long long *credit, struct timespec *last)
+{
+	long long depth = bucket_depth(rate, burst);
+	long long ns;
 
-		return 0;
+	ns = (iv_now.tv_sec - last->tv_sec) * NSEC_PER_SEC +
+		iv_now.tv_nsec - last->tv_nsec;
+	*last = iv_now;
+
+	if (ns <= 0)
+		return;
+
+	if (ns > (depth - *credit) / rate)
+		*credit = depth;
+	else
+		*credit += ns * rate;
+}
+
+/*
+ * The credit below which a bucket counts as empty.
+ */
+static long long bucket_low(unsigned int rate, unsigned int burst)
+{
+	long long want;
+
+	want = rate / REFILL_HZ;
+	if (want > bucket_depth(rate, burst) / NSEC_PER_SEC)
+		want = bucket_depth(rate, burst) / NSEC_PER_SEC;
+	if (want < 1)
+		want = 1;
+
+	return want * NSEC_PER_SEC;
+}
+
+static void bucket_wait(unsigned int rate, unsigned int burst,
+			long long credit, struct timespec *expires)
+{
+	long long ns;
+
+	ns = (bucket_low(rate, burst) - credit + rate - 1) / rate;
+
+	*expires = iv_now;
+	expires->tv_sec += ns / NSEC_PER_SEC;
+	expires->tv_nsec += ns % NSEC_PER_SEC;
+	if (expires->tv_nsec >= NSEC_PER_SEC) {
+		expires->tv_sec++;
+		expires->tv_nsec -= NSEC_PER_SEC;
 	}
+}
 
-	if (ret == 0) {
-		ip->saw_fin = 1;
-		if (!ip->bytes) {
-			if (ip->flags & IV_FD_PUMP_FLAG_RELAY_EOF)
-				shutdown(ip->to_fd, SHUT_WR);
-			ip->saw_fin = 2;
-		}
-		return 0;
+static void iv_fd_pump_throttle_end(struct iv_fd_pump *ip)
+{
+	ip->throttled = 0;
+	ip->stats.throttled_nsec += nsec_since(&ip->throttled_since);
+}
+
+static void iv_fd_pump_group_refill(void *_group)
+{
+	struct iv_fd_pump_group *group = _group;
+
+	while (!iv_list_empty(&group->waiting)) {
+		struct iv_fd_pump *ip;
+
+		ip = iv_container_of(group->waiting.next,
+				     struct iv_fd_pump, group_list);
+
+		iv_list_del_init(&ip->group_list);
+		iv_fd_pump_throttle_end(ip);
+		iv_fd_pump_update_bands(ip);
 	}
+}
 
-	ip->bytes += ret;
-	if (!splice_available && ip->bytes == BUF_SIZE)
-		ip->full = 1;
+void iv_fd_pump_group_init(struct iv_fd_pump_group *group)
+{
+	group->credit = bucket_depth(group->rate, group->burst);
+	group->last = iv_now;
 
-	return 0;
+	IV_TIMER_INIT(&group->refill);
+	group->refill.cookie = group;
+	group->refill.handler = iv_fd_pump_group_refill;
+
+	INIT_IV_LIST_HEAD(&group->waiting);
 }
 
-static int iv_fd_pump_try_output(struct iv_fd_pump *ip)
+void iv_fd_pump_group_destroy(struct iv_fd_pump_group *group)
 {
-	struct iv_fd_pump_buf *buf = iv_fd_pump_buf(ip);
-	int ret;
+	if (!iv_list_empty(&group->waiting))
+		iv_fatal("iv_fd_pump_group_destroy: group still in use");
 
-	do {
-		if (!splice_available) {
-			ret = write(ip->to_fd, buf->u.buf, ip->bytes);
-		} else {
-			ret = splice(buf->u.pfd[0], NULL, ip->to_fd, NULL,
-				     ip->bytes, 0);
-		}
-	} while (ret < 0 && errno == EINTR);
+	if (iv_timer_registered(&group->refill))
+		iv_timer_unregister(&group->refill);
+}
 
-	if (ret <= 0)
-		return (ret < 0 && errno == EAGAIN) ? 0 : -1;
+static void iv_fd_pump_refill(void *_ip)
+{
+	struct iv_fd_pump *ip = _ip;
 
-	ip->full = 0;
+	iv_fd_pump_throttle_end(ip);
+	iv_fd_pump_update_bands(ip);
+}
 
-	ip->bytes -= ret;
-	if (!splice_available)
-		memmove(buf->u.buf, buf->u.buf + ret, ip->bytes);
+/*
+ * Return the number of bytes that the pump may read right now, or
+ * zero if one of its buckets is (nearly) empty, so that a pump that
+ * is limited doesn't end up reading a handful of bytes at a time.
+ */
+static int iv_fd_pump_allowance(struct iv_fd_pump *ip)
+{
+	struct iv_fd_pump_group *group = ip->group;
+	long long allow = INT_MAX;
+
+	if (ip->rate) {
+		bucket_refill(ip->rate, ip->burst, &ip->credit, &ip->last);
+		if (ip->credit < bucket_low(ip->rate, ip->burst))
+			return 0;
+		if (allow > ip->credit / NSEC_PER_SEC)
+			allow = ip->credit / NSEC_PER_SEC;
+	}
 
-	if (!ip->bytes && ip->saw_fin == 1) {
-		if (ip->flags & IV_FD_PUMP_FLAG_RELAY_EOF)
-			shutdown(ip->to_fd, SHUT_WR);
-		ip->saw_fin = 2;
+	if (group != NULL && group->rate) {
+		bucket_refill(group->rate, group->burst,
+			      &group->credit, &group->last);
+		if (group->credit < bucket_low(group->rate, group->burst))
+			return 0;
+		if (allow > group->credit / NSEC_PER_SEC)
+			allow = group->credit / NSEC_PER_SEC;
 	}
 
-	return 0;
+	return allow;
 }
 
-static int __iv_fd_pump_pump(struct iv_fd_pump *ip)
+static void iv_fd_pump_charge(struct iv_fd_pump *ip, int bytes)
 {
-	if (!ip->full && ip->saw_fin == 0 && iv_fd_pump_try_input(ip))
-		return -1;
+	if (ip->rate)
+		ip->credit -= bytes * NSEC_PER_SEC;
 
-	if (ip->bytes && iv_fd_pump_try_output(ip))
-		return -1;
+	if (ip->group != NULL && ip->group->rate)
+		ip->group->credit -= bytes * NSEC_PER_SEC;
+}
 
+static void iv_fd_pump_throttle(struct iv_fd_pump *ip)
+{
+	struct iv_fd_pump_group *group = ip->group;
 
-	switch (ip->saw_fin) {
-	case 0:
-		ip->set_bands(ip->cookie, !ip->full, !!ip->bytes);
-		return 1;
+	ip->throttled = 1;
+	ip->throttled_since = iv_now;
 
-	case 1:
-		ip->set_bands(ip->cookie, 0, 1);
-		return 1;
+	if (ip->rate && ip->credit < bucket_low(ip->rate, ip->burst)) {
+		bucket_wait(ip->rate, ip->burst, ip->credit,
+			    &ip->refill.expires);
+		iv_timer_register(&ip->refill);
+		return;
+	}
 
-	case 2:
-		ip->set_bands(ip->cookie, 0, 0);
-		return 0;
+	iv_list_add_tail(&ip->group_list, &group->waiting);
+	if (!iv_timer_registered(&group->refill)) {
+		bucket_wait(group->rate, group->burst, group->credit,
+			    &group->refill.expires);
+		iv_timer_register(&group->refill);
 	}
+}
+
+static void iv_fd_pump_unthrottle(struct iv_fd_pump *ip)
+{
+	if (!ip->throttled)
+		return;
+
+	iv_fd_pump_throttle_end(ip);
 
-	iv_fatal("iv_fd_pump_pump: saw_fin == %d", ip->saw_fin);
+	if (iv_timer_registered(&ip->refill))
+		iv_timer_unregister(&ip->refill);
+
+	if (!iv_list_empty(&ip->group_list)) {
+		iv_list_del_init(&ip->group_list);
+		if (iv_list_empty(&ip->group->waiting))
+			iv_timer_unregister(&ip->group->refill);
+	}
 }
 
-int iv_fd_pump_pump(struct iv_fd_pump *ip)
+
+/* direct file transfer ****************************************************/
+/*
+ * If the input is a regular file, the data can be moved without
+ * going through a pipe or a userspace buffer, with copy_file_range(2)
+ * if the output is a regular file as well, or with sendfile(2)
+ * otherwise.  Both use and advance the file offset of ->from_fd, so
+ * we can fall back to the buffered path at any point if the kernel
+ * doesn't support the operation for this pair of file descriptors.
+ */
+#define DIRECT_NONE		0
+#define DIRECT_SENDFILE		1
+#define DIRECT_COPY_FILE_RANGE	2
+
+#define DIRECT_CHUNK		1048576
+
+static int direct_mode(struct iv_fd_pump *ip)
 {
-	int ret;
+#if defined(HAVE_SENDFILE) || defined(HAVE_COPY_FILE_RANGE)
+	struct stat st;
 
-	ret = __iv_fd_pump_pump(ip);
-	if (ret < 0 || !ip->bytes) {
-		struct iv_fd_pump_buf *buf = iv_fd_pump_buf(ip);
+	if (fstat(ip->from_fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return DIRECT_NONE;
+
+#ifdef HAVE_COPY_FILE_RANGE
+	if (fstat(ip->to_fd, &st) == 0 && S_ISREG(st.st_mode))
+		return DIRECT_COPY_FILE_RANGE;
+#endif
+
+#ifdef HAVE_SENDFILE
+	return DIRECT_SENDFILE;
+#endif
+#endif
+
+	return DIRECT_NONE;
+}
+
+static int iv_fd_pump_try_direct(struct iv_fd_pump *ip, int max)
+{
+	size_t len = (max < DIRECT_CHUNK) ? max : DIRECT_CHUNK;
+	ssize_t ret;
+
+	do {
+		ip->stats.syscalls++;
+#ifdef HAVE_COPY_FILE_RANGE
+		if (ip->direct == DIRECT_COPY_FILE_RANGE) {
+			ret = copy_file_range(ip->from_fd, NULL, ip->to_fd,
+					      NULL, len, 0);
+			continue;
+		}
+#endif
+#ifdef HAVE_SENDFILE
+		ret = sendfile(ip->to_fd, ip->from_fd, NULL, len);
+#else
+		ret = -1;
+		errno = ENOSYS;
+#endif
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		if (errno == EAGAIN)
+			return 0;
 
-		if (buf != NULL) {
-			buf_put(buf, ip->bytes);
-			ip->buf = NULL;
+		if (errno != EINVAL && errno != ENOSYS &&
+		    errno != EXDEV && errno != EOPNOTSUPP) {
+			return -1;
+		}
+
+		/*
+		 * Not supported for these file descriptors, so try
+		 * sendfile(2) if we were using copy_file_range(2),
+		 * and otherwise use the buffered path from now on.
+		 */
+#ifdef HAVE_SENDFILE
+		if (ip->direct == DIRECT_COPY_FILE_RANGE) {
+			ip->direct = DIRECT_SENDFILE;
+			return iv_fd_pump_try_direct(ip, max);
 		}
+#endif
+		ip->direct = DIRECT_NONE;
+
+		return 0;
 	}
 
-	return ret;
+	if (ret == 0) {
+		if (ip->flags & IV_FD_PUMP_FLAG_RELAY_EOF)
+			shutdown(ip->to_fd, SHUT_WR);
+		ip->saw_fin = 2;
+	} else {
+		ip->stats.bytes_spliced += ret;
+		iv_fd_pump_charge(ip, ret);
+	}
+
+	return 0;
 }
 
-int iv_fd_pump_is_done(const struct iv_fd_pump *ip)
+
+/* zerocopy transmission ***************************************************/
+/*
+ * With MSG_ZEROCOPY, the kernel numbers the zerocopy sends on a
+ * socket sequentially, starting from zero, and signals their
+ * completion by queueing (possibly coalesced) ranges of these
+ * numbers on the socket error queue.  ->zc_sent and ->zc_done track
+ * the numbers of the next send and of the oldest outstanding one,
+ * which is why zerocopy is only used on sockets that didn't have
+ * SO_ZEROCOPY enabled before the pump was initialised.
+ */
+#ifdef HAVE_ZEROCOPY
+static void zc_complete(struct iv_fd_pump *ip, struct iv_fd_pump_buf *buf,
+			unsigned int lo, unsigned int hi)
 {
-	return !!(ip->saw_fin == 2);
+	unsigned int id;
+
+	for (id = lo; ; id++) {
+		if (id - ip->zc_done < ip->zc_sent - ip->zc_done) {
+			int *len = &buf->u.zc.len[id % ZC_MAX_SENDS];
+
+			if (*len > 0)
+				*len = -*len;
+		}
+
+		if (id == hi)
+			break;
+	}
+
+	while (ip->zc_done != ip->zc_sent) {
+		int len = buf->u.zc.len[ip->zc_done % ZC_MAX_SENDS];
+
+		if (len > 0)
+			break;
+
+		buf->head = (buf->head - len) % buf->size;
+		buf->u.zc.inflight += len;
+		buf->u.zc.nobufs = 0;
+		iv_fd_pump_set_full(ip, 0);
+		ip->zc_done++;
+	}
+}
+
+static int zc_reap(struct iv_fd_pump *ip, struct iv_fd_pump_buf *buf)
+{
+	while (ip->zc_sent != ip->zc_done) {
+		union {
+			struct cmsghdr	cmsg;
+			char		buf[CMSG_SPACE(
+					    sizeof(struct sock_extended_err) +
+					    sizeof(struct sockaddr_in6))];
+		} control;
+		struct msghdr msg;
+		struct cmsghdr *cmsg;
+		int ret;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = &control;
+		msg.msg_controllen = sizeof(control);
+
+		do {
+			ip->stats.syscalls++;
+			ret = recvmsg(ip->to_fd, &msg, MSG_ERRQUEUE);
+		} while (ret < 0 && errno == EINTR);
+
+		if (ret < 0)
+			return (errno == EAGAIN) ? 0 : -1;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			struct sock_extended_err *ee;
+
+			if (!(cmsg->cmsg_level == IPPROTO_IP &&
+			      cmsg->cmsg_type == IP_RECVERR) &&
+			    !(cmsg->cmsg_level == IPPROTO_IPV6 &&
+			      cmsg->cmsg_type == IPV6_RECVERR)) {
+				continue;
+			}
+
+			ee = (struct sock_extended_err *)CMSG_DATA(cmsg);
+			if (ee->ee_errno == 0 &&
+			    ee->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+				zc_complete(ip, buf, ee->ee_info, ee->ee_data);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int zc_send(struct iv_fd_pump *ip, struct iv_fd_pump_buf *buf)
+{
+	struct iovec iov[2];
+	struct msghdr msg;
+	int ret;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = buf_iov(buf, (buf->head + buf->u.zc.inflight) %
+				 buf->size, ip->bytes, iov);
+
+	ret = sendmsg(ip->to_fd, &msg, MSG_ZEROCOPY);
+	if (ret > 0) {
+		buf->u.zc.len[ip->zc_sent % ZC_MAX_SENDS] = ret;
+		buf->u.zc.inflight += ret;
+		ip->zc_sent++;
+	} else if (ret < 0 && errno == ENOBUFS) {
+		/*
+		 * The socket ran out of memory for tracking pinned
+		 * pages.  Wait for outstanding sends to complete if
+		 * there are any, or else just copy the data.
+		 */
+		if (buf->u.zc.inflight) {
+			buf->u.zc.nobufs = 1;
+			errno = EAGAIN;
+		} else {
+			ip->stats.syscalls++;
+			ret = sendmsg(ip->to_fd, &msg, 0);
+		}
+	}
+
+	return ret;
+}
+#else
+#define zc_reap(ip, buf)	0
+#define zc_send(ip, buf)	-1
+#endif
+
+static int zc_stalled(struct iv_fd_pump *ip, struct iv_fd_pump_buf *buf)
+{
+	if (buf == NULL || buf->type != BUF_ZEROCOPY)
+		return 0;
+
+	return ip->zc_sent - ip->zc_done == ZC_MAX_SENDS || buf->u.zc.nobufs;
+}
+
+
+/* iv_fd_pump ***************************************************************/
+static struct iv_fd_pump_buf *iv_fd_pump_buf(struct iv_fd_pump *ip)
+{
+	return (struct iv_fd_pump_buf *)ip->buf;
+}
+
+static void iv_fd_pump_put_buf(struct iv_fd_pump *ip)
+{
+	struct iv_fd_pump_buf *buf = iv_fd_pump_buf(ip);
+
+	if (buf != NULL) {
+		buf_put(buf, ip->bytes);
+		ip->buf = NULL;
+		ip->zc_done = ip->zc_sent;
+	}
+}
+
+static int iv_fd_pump_buf_type(struct iv_fd_pump *ip)
+{
+	if (ip->zerocopy)
+		return BUF_ZEROCOPY;
+
+	return splice_available ? BUF_PIPE : BUF_MEMORY;
+}
+
+void iv_fd_pump_init(struct iv_fd_pump *ip)
+{
+	struct iv_fd_pump_thr_info *tinfo;
+
+	if (splice_available == -1)
+		check_splice_available();
+
+	if (ip->buf_size <= 0)
+		ip->buf_size = DEFAULT_BUF_SIZE;
+
+	ip->buf = NULL;
+	ip->bytes = 0;
+	ip->full = 0;
+	ip->saw_fin = 0;
+	ip->direct = direct_mode(ip);
+	ip->zerocopy = 0;
+	ip->zc_sent = 0;
+	ip->zc_done = 0;
+
+#ifdef HAVE_ZEROCOPY
+	if (!ip->direct && (ip->flags & IV_FD_PUMP_FLAG_ZEROCOPY)) {
+		socklen_t len;
+		int on;
+
+		/*
+		 * The completion IDs only line up with ->zc_sent if
+		 * this pump is the first user of MSG_ZEROCOPY on the
+		 * socket, which we can only be sure of if SO_ZEROCOPY
+		 * wasn't enabled on it yet.
+		 */
+		len = sizeof(on);
+		if (getsockopt(ip->to_fd, SOL_SOCKET, SO_ZEROCOPY,
+			       &on, &len) == 0 && !on) {
+			on = 1;
+			if (setsockopt(ip->to_fd, SOL_SOCKET, SO_ZEROCOPY,
+				       &on, sizeof(on)) == 0) {
+				ip->zerocopy = 1;
+			}
+		}
+	}
+#endif
+
+	ip->throttled = 0;
+	if (ip->rate) {
+		ip->credit = bucket_depth(ip->rate, ip->burst);
+		ip->last = iv_now;
+	}
+
+	IV_TIMER_INIT(&ip->refill);
+	ip->refill.cookie = ip;
+	ip->refill.handler = iv_fd_pump_refill;
+
+	INIT_IV_LIST_HEAD(&ip->group_list);
+
+	memset(&ip->stats, 0, sizeof(ip->stats));
+	tinfo = iv_tls_user_ptr(&iv_fd_pump_tls_user);
+	iv_list_add_tail(&ip->thr_list, &tinfo->pumps);
+
+	iv_fd_pump_update_bands(ip);
+}
+
+void iv_fd_pump_destroy(struct iv_fd_pump *ip)
+{
+	struct iv_fd_pump_thr_info *tinfo =
+		iv_tls_user_ptr(&iv_fd_pump_tls_user);
+
+	iv_fd_pump_unthrottle(ip);
+	iv_fd_pump_set_full(ip, 0);
+
+	iv_list_del(&ip->thr_list);
+	stats_add(&tinfo->stats, &ip->stats);
+
+	if (ip->saw_fin != 2)
+		ip->set_bands(ip->cookie, 0, 0);
+
+	iv_fd_pump_put_buf(ip);
+}
+
+static int iv_fd_pump_try_input(struct iv_fd_pump *ip, int max)
+{
+	struct iv_fd_pump_buf *buf = iv_fd_pump_buf(ip);
+	int ret;
+
+	if (buf == NULL) {
+		buf = buf_get(ip->buf_size, iv_fd_pump_buf_type(ip));
+		if (buf == NULL)
+			return -1;
+
+		ip->buf = (void *)buf;
+	}
+
+	do {
+		ip->stats.syscalls++;
+		if (buf->type != BUF_PIPE) {
+			struct iovec iov[2];
+			int used;
+
+			used = buf_inflight(buf) + ip->bytes;
+			if (max > buf->size - used)
+				max = buf->size - used;
+
+			ret = readv(ip->from_fd, iov,
+				    buf_iov(buf, (buf->head + used) % buf->size,
+					    max, iov));
+		} else {
+			ret = splice(ip->from_fd, NULL, buf->u.pfd[1], NULL,
+				     max < 1048576 ? max : 1048576,
+				     SPLICE_F_NONBLOCK);
+		}
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		if (errno != EAGAIN)
+			return -1;
+
+		if (buf->type == BUF_PIPE && ip->bytes) {
+			int bytes = 1;
+
+			ip->stats.syscalls++;
+			ioctl(ip->from_fd, FIONREAD, &bytes);
+			if (bytes > 0)
+				iv_fd_pump_set_full(ip, 1);
+		}
+
+		return 0;
+	}
+
+	if (ret == 0) {
+		ip->saw_fin = 1;
+		if (!ip->bytes) {
+			if (ip->flags & IV_FD_PUMP_FLAG_RELAY_EOF)
+				shutdown(ip->to_fd, SHUT_WR);
+			ip->saw_fin = 2;
+		}
+		return 0;
+	}
+
+	ip->bytes += ret;
+	iv_fd_pump_charge(ip, ret);
+	if (buf->type != BUF_PIPE &&
+	    buf_inflight(buf) + ip->bytes == buf->size) {
+		iv_fd_pump_set_full(ip, 1);
+	}
+
+	return 0;
+}
+
+static int iv_fd_pump_try_output(struct iv_fd_pump *ip)
+{
+	struct iv_fd_pump_buf *buf = iv_fd_pump_buf(ip);
+	int ret;
+
+	do {
+		ip->stats.syscalls++;
+		if (buf->type == BUF_MEMORY) {
+			struct iovec iov[2];
+
+			ret = writev(ip->to_fd, iov,
+				     buf_iov(buf, buf->head, ip->bytes, iov));
+		} else if (buf->type == BUF_ZEROCOPY) {
+			ret = zc_send(ip, buf);
+		} else {
+			ret = splice(buf->u.pfd[0], NULL, ip->to_fd, NULL,
+				     ip->bytes, 0);
+		}
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret <= 0)
+		return (ret < 0 && errno == EAGAIN) ? 0 : -1;
+
+	ip->bytes -= ret;
+	if (buf->type == BUF_PIPE)
+		ip->stats.bytes_spliced += ret;
+	else
+		ip->stats.bytes_copied += ret;
+
+	/*
+	 * Data sent with MSG_ZEROCOPY stays in the buffer until the
+	 * send completes, so that doesn't free up any space yet.
+	 */
+	if (!buf_inflight(buf)) {
+		iv_fd_pump_set_full(ip, 0);
+		if (buf->type != BUF_PIPE) {
+			buf->head = ip->bytes ?
+				(buf->head + ret) % buf->size : 0;
+		}
+	}
+
+	if (!ip->bytes && ip->saw_fin == 1) {
+		if (ip->flags & IV_FD_PUMP_FLAG_RELAY_EOF)
+			shutdown(ip->to_fd, SHUT_WR);
+		ip->saw_fin = 2;
+	}
+
+	return 0;
+}
+
+static void iv_fd_pump_update_bands(struct iv_fd_pump *ip)
+{
+	int pollin;
+	int pollout;
+
+	if (ip->saw_fin == 2) {
+		pollin = 0;
+		pollout = 0;
+	} else if (ip->direct) {
+		/*
+		 * Regular files are always readable (and can't be
+		 * polled on with most poll methods anyway), so in
+		 * direct mode, we only ever wait for the output side.
+		 */
+		pollin = 0;
+		pollout = !ip->throttled;
+	} else {
+		pollin = !ip->full && ip->saw_fin == 0 && !ip->throttled;
+		pollout = ip->bytes && !zc_stalled(ip, iv_fd_pump_buf(ip));
+	}
+
+	ip->set_bands(ip->cookie, pollin, pollout);
+}
+
+/*
+ * Return the number of bytes that the pump may read, and throttle
+ * it if the rate limits don't allow it to read anything at all.
+ */
+static int iv_fd_pump_input_allowance(struct iv_fd_pump *ip)
+{
+	int max;
+
+	if (ip->throttled)
+		return 0;
+
+	if (!ip->rate && (ip->group == NULL || !ip->group->rate))
+		return INT_MAX;
+
+	max = iv_fd_pump_allowance(ip);
+	if (!max)
+		iv_fd_pump_throttle(ip);
+
+	return max;
+}
+
+static int __iv_fd_pump_pump(struct iv_fd_pump *ip)
+{
+	int max;
+
+	if (ip->direct) {
+		max = iv_fd_pump_input_allowance(ip);
+		if (max && iv_fd_pump_try_direct(ip, max))
+			return -1;
+
+		if (ip->direct || ip->saw_fin == 2) {
+			iv_fd_pump_update_bands(ip);
+			return ip->saw_fin != 2;
+		}
+	}
+
+	if (ip->zc_sent != ip->zc_done && zc_reap(ip, iv_fd_pump_buf(ip)))
+		return -1;
+
+	if (!ip->full && ip->saw_fin == 0) {
+		max = iv_fd_pump_input_allowance(ip);
+		if (max && iv_fd_pump_try_input(ip, max))
+			return -1;
+	}
+
+	if (ip->bytes && !zc_stalled(ip, iv_fd_pump_buf(ip)) &&
+	    iv_fd_pump_try_output(ip)) {
+		return -1;
+	}
+
+	iv_fd_pump_update_bands(ip);
+
+	return ip->saw_fin != 2;
+}
+
+int iv_fd_pump_pump(struct iv_fd_pump *ip)
+{
+	int ret;
+
+	ret = __iv_fd_pump_pump(ip);
+	if (ret <= 0 || (ip->buf != NULL && !ip->bytes &&
+			 !buf_inflight(iv_fd_pump_buf(ip)))) {
+		iv_fd_pump_put_buf(ip);
+	}
+
+	return ret;
+}
+
+int iv_fd_pump_is_done(const struct iv_fd_pump *ip)
+{
+	return !!(ip->saw_fin == 2);
+}
+
+
+/* iv_fd_pump_tee ***********************************************************/
+/*
+ * A tee pump reads data from one file descriptor once, and writes
+ * it to any number of sinks.
+ *
+ * When splicing, each batch of data is spliced from ->from_fd into
+ * a pipe, and duplicated from there into a pipe per sink with
+ * tee(2), except for the last sink, which has the data moved into
+ * its pipe with splice(2), which leaves the source pipe empty
+ * again.  A sink's pipe has to be empty before it can take the next
+ * batch, which guarantees that it has room for whatever the
+ * (equally sized) source pipe could hold, while the socket buffers
+ * of the sinks still let them run ahead of each other.
+ *
+ * Otherwise, the data is read into a ring buffer that is shared by
+ * all sinks, where ->bytes bytes starting at ->head are the data
+ * that the slowest sink still has to send, and the data that each
+ * sink still has to send is the last ->bytes bytes of that.
+ *
+ * If the source has been unable to take more data for more than
+ * ->max_lag_msec milliseconds because of some sinks, while other
+ * sinks could have taken more data, the sinks that are holding the
+ * source back are dropped.
+ */
+static void tee_ring_update(struct iv_fd_pump_tee *t)
+{
+	struct iv_fd_pump_buf *buf = (struct iv_fd_pump_buf *)t->buf;
+	int max;
+	int i;
+
+	if (buf == NULL)
+		return;
+
+	max = 0;
+	for (i = 0; i < t->num_sinks; i++) {
+		struct iv_fd_pump_tee_sink *sink = &t->sinks[i];
+
+		if (sink->active && sink->bytes > max)
+			max = sink->bytes;
+	}
+
+	buf->head = (buf->head + t->bytes - max) % buf->size;
+	t->bytes = max;
+
+	if (!max) {
+		buf_put(buf, 0);
+		t->buf = NULL;
+	}
+}
+
+static void tee_sink_put_buf(struct iv_fd_pump_tee_sink *sink)
+{
+	if (sink->buf != NULL) {
+		buf_put((struct iv_fd_pump_buf *)sink->buf, sink->bytes);
+		sink->buf = NULL;
+	}
+}
+
+static void tee_drop_sink(struct iv_fd_pump_tee *t,
+			  struct iv_fd_pump_tee_sink *sink)
+{
+	sink->active = 0;
+	t->num_active--;
+
+	sink->set_pollout(sink->cookie, 0);
+
+	if (splice_available) {
+		tee_sink_put_buf(sink);
+		sink->bytes = 0;
+	} else {
+		sink->bytes = 0;
+		tee_ring_update(t);
+	}
+
+	if (sink->dropped != NULL)
+		sink->dropped(sink->cookie);
+}
+
+static int tee_sink_blocking(const struct iv_fd_pump_tee *t,
+			     const struct iv_fd_pump_tee_sink *sink)
+{
+	if (splice_available)
+		return !!sink->bytes;
+
+	return sink->bytes == t->buf_size;
+}
+
+static int tee_can_read(const struct iv_fd_pump_tee *t)
+{
+	int i;
+
+	if (!t->num_active)
+		return 0;
+
+	for (i = 0; i < t->num_sinks; i++) {
+		const struct iv_fd_pump_tee_sink *sink = &t->sinks[i];
+
+		if (sink->active && tee_sink_blocking(t, sink))
+			return 0;
+	}
+
+	return 1;
+}
+
+static void tee_arm_lag_timer(struct iv_fd_pump_tee *t)
+{
+	int msec = t->max_lag_msec;
+
+	iv_validate_now();
+	t->lag_timer.expires = iv_now;
+	t->lag_timer.expires.tv_sec += msec / 1000;
+	t->lag_timer.expires.tv_nsec += 1000000L * (msec % 1000);
+	if (t->lag_timer.expires.tv_nsec >= 1000000000L) {
+		t->lag_timer.expires.tv_sec++;
+		t->lag_timer.expires.tv_nsec -= 1000000000L;
+	}
+	iv_timer_register(&t->lag_timer);
+}
+
+static void tee_update_bands(struct iv_fd_pump_tee *t)
+{
+	int pollin;
+	int i;
+
+	pollin = (t->saw_fin == 0 && tee_can_read(t));
+	if (t->saw_fin != 2)
+		t->set_pollin(t->cookie, pollin);
+
+	for (i = 0; i < t->num_sinks; i++) {
+		struct iv_fd_pump_tee_sink *sink = &t->sinks[i];
+
+		if (sink->active)
+			sink->set_pollout(sink->cookie, !!sink->bytes);
+	}
+
+	if (t->saw_fin == 0 && !pollin && t->num_active &&
+	    t->max_lag_msec) {
+		if (!iv_timer_registered(&t->lag_timer))
+			tee_arm_lag_timer(t);
+	} else if (iv_timer_registered(&t->lag_timer)) {
+		iv_timer_unregister(&t->lag_timer);
+	}
+}
+
+static void tee_lag_expired(void *_t)
+{
+	struct iv_fd_pump_tee *t = _t;
+	int unblocked;
+	int i;
+
+	unblocked = 0;
+	for (i = 0; i < t->num_sinks; i++) {
+		struct iv_fd_pump_tee_sink *sink = &t->sinks[i];
+
+		if (sink->active && !tee_sink_blocking(t, sink))
+			unblocked++;
+	}
+
+	/*
+	 * If all sinks are equally slow, there's nobody to drop.
+	 */
+	if (unblocked) {
+		for (i = 0; i < t->num_sinks; i++) {
+			struct iv_fd_pump_tee_sink *sink = &t->sinks[i];
+
+			if (sink->active && tee_sink_blocking(t, sink))
+				tee_drop_sink(t, sink);
+		}
+	}
+
+	tee_update_bands(t);
+}
+
+void iv_fd_pump_tee_init(struct iv_fd_pump_tee *t)
+{
+	int i;
+
+	if (splice_available == -1)
+		check_splice_available();
+
+	if (t->buf_size <= 0)
+		t->buf_size = DEFAULT_BUF_SIZE;
+
+	t->buf = NULL;
+	t->bytes = 0;
+	t->saw_fin = 0;
+	t->num_active = t->num_sinks;
+
+	for (i = 0; i < t->num_sinks; i++) {
+		struct iv_fd_pump_tee_sink *sink = &t->sinks[i];
+
+		sink->buf = NULL;
+		sink->bytes = 0;
+		sink->active = 1;
+	}
+
+	IV_TIMER_INIT(&t->lag_timer);
+	t->lag_timer.cookie = t;
+	t->lag_timer.handler = tee_lag_expired;
+
+	tee_update_bands(t);
+}
+
+void iv_fd_pump_tee_destroy(struct iv_fd_pump_tee *t)
+{
+	int i;
+
+	if (iv_timer_registered(&t->lag_timer))
+		iv_timer_unregister(&t->lag_timer);
+
+	if (t->saw_fin != 2)
+		t->set_pollin(t->cookie, 0);
+
+	for (i = 0; i < t->num_sinks; i++) {
+		struct iv_fd_pump_tee_sink *sink = &t->sinks[i];
+
+		if (sink->active) {
+			sink->set_pollout(sink->cookie, 0);
+			tee_sink_put_buf(sink);
+		}
+	}
+
+	if (t->buf != NULL) {
+		buf_put((struct iv_fd_pump_buf *)t->buf, 0);
+		t->buf = NULL;
+	}
+}
+
+static int tee_sink_fill(struct iv_fd_pump_tee *t,
+			 struct iv_fd_pump_tee_sink *sink,
+			 struct iv_fd_pump_buf *src, int len, int move)
+{
+	struct iv_fd_pump_buf *buf = (struct iv_fd_pump_buf *)sink->buf;
+	int ret;
+
+	if (buf == NULL) {
+		buf = buf_get(t->buf_size, BUF_PIPE);
+		if (buf == NULL)
+			return -1;
+
+		sink->buf = (void *)buf;
+	}
+
+	do {
+		if (move) {
+			ret = splice(src->u.pfd[0], NULL, buf->u.pfd[1], NULL,
+				     len, SPLICE_F_NONBLOCK);
+		} else {
+			ret = tee(src->u.pfd[0], buf->u.pfd[1],
+				  len, SPLICE_F_NONBLOCK);
+		}
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret > 0)
+		sink->bytes += ret;
+
+	return ret;
+}
+
+static int tee_distribute(struct iv_fd_pump_tee *t,
+			  struct iv_fd_pump_buf *src, int len)
+{
+	int left;
+	int last;
+	int i;
+
+	last = -1;
+	for (i = 0; i < t->num_sinks; i++) {
+		if (t->sinks[i].active)
+			last = i;
+	}
+
+	left = len;
+	for (i = 0; i <= last; i++) {
+		struct iv_fd_pump_tee_sink *sink = &t->sinks[i];
+		int ret;
+
+		if (!sink->active)
+			continue;
+
+		ret = tee_sink_fill(t, sink, src, len, i == last);
+		if (i == last && ret > 0)
+			left -= ret;
+
+		/*
+		 * This can only happen if the sink's pipe couldn't be
+		 * resized to the size of the source pipe.
+		 */
+		if (ret != len)
+			tee_drop_sink(t, sink);
+	}
+
+	return left;
+}
+
+static int tee_try_input(struct iv_fd_pump_tee *t)
+{
+	struct iv_fd_pump_buf *buf = (struct iv_fd_pump_buf *)t->buf;
+	int ret;
+	int i;
+
+	if (buf == NULL) {
+		buf = buf_get(t->buf_size,
+			      splice_available ? BUF_PIPE : BUF_MEMORY);
+		if (buf == NULL)
+			return -1;
+
+		if (!splice_available)
+			t->buf = (void *)buf;
+	}
+
+	do {
+		if (!splice_available) {
+			struct iovec iov[2];
+
+			ret = readv(t->from_fd, iov,
+				    buf_iov(buf, (buf->head + t->bytes) %
+					    buf->size, buf->size - t->bytes,
+					    iov));
+		} else {
+			ret = splice(t->from_fd, NULL, buf->u.pfd[1], NULL,
+				     1048576, SPLICE_F_NONBLOCK);
+		}
+	} while (ret < 0 && errno == EINTR);
+
+	if (splice_available) {
+		buf_put(buf, ret > 0 ? tee_distribute(t, buf, ret) : 0);
+	} else if (ret > 0) {
+		t->bytes += ret;
+		for (i = 0; i < t->num_sinks; i++) {
+			if (t->sinks[i].active)
+				t->sinks[i].bytes += ret;
+		}
+	} else {
+		tee_ring_update(t);
+	}
+
+	if (ret < 0)
+		return (errno == EAGAIN) ? 0 : -1;
+
+	if (ret == 0)
+		t->saw_fin = 1;
+
+	return 0;
+}
+
+static int tee_sink_output(struct iv_fd_pump_tee *t,
+			   struct iv_fd_pump_tee_sink *sink)
+{
+	struct iv_fd_pump_buf *buf;
+	int ret;
+
+	if (splice_available)
+		buf = (struct iv_fd_pump_buf *)sink->buf;
+	else
+		buf = (struct iv_fd_pump_buf *)t->buf;
+
+	do {
+		if (!splice_available) {
+			struct iovec iov[2];
+			int off;
+
+			off = (buf->head + t->bytes - sink->bytes) % buf->size;
+			ret = writev(sink->fd, iov,
+				     buf_iov(buf, off, sink->bytes, iov));
+		} else {
+			ret = splice(buf->u.pfd[0], NULL, sink->fd, NULL,
+				     sink->bytes, 0);
+		}
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret <= 0)
+		return (ret < 0 && errno == EAGAIN) ? 0 : -1;
+
+	sink->bytes -= ret;
+	if (splice_available && !sink->bytes)
+		tee_sink_put_buf(sink);
+
+	return 0;
+}
+
+int iv_fd_pump_tee_pump(struct iv_fd_pump_tee *t)
+{
+	int i;
+
+	if (t->saw_fin == 0 && tee_can_read(t) && tee_try_input(t))
+		return -1;
+
+	for (i = 0; i < t->num_sinks; i++) {
+		struct iv_fd_pump_tee_sink *sink = &t->sinks[i];
+
+		if (sink->active && sink->bytes && tee_sink_output(t, sink))
+			tee_drop_sink(t, sink);
+	}
+
+	if (!splice_available)
+		tee_ring_update(t);
+
+	if (!t->num_active)
+		return -1;
+
+	if (t->saw_fin == 1 && !t->bytes) {
+		for (i = 0; i < t->num_sinks; i++) {
+			struct iv_fd_pump_tee_sink *sink = &t->sinks[i];
+
+			if (sink->active && sink->bytes)
+				break;
+		}
+
+		if (i == t->num_sinks) {
+			t->set_pollin(t->cookie, 0);
+			t->saw_fin = 2;
+
+			for (i = 0; i < t->num_sinks; i++) {
+				struct iv_fd_pump_tee_sink *sink = &t->sinks[i];
+
+				if (sink->active &&
+				    (t->flags & IV_FD_PUMP_FLAG_RELAY_EOF)) {
+					shutdown(sink->fd, SHUT_WR);
+				}
+			}
+		}
+	}
+
+	tee_update_bands(t);
+
+	return t->saw_fin != 2;
+}
+
+int iv_fd_pump_tee_is_done(const struct iv_fd_pump_tee *t)
+{
+	return !!(t->saw_fin == 2);
 }
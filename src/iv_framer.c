@@ -0,0 +1,466 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iv.h>
+#include <iv_framer.h>
+#include <string.h>
+#include <unistd.h>
+#include "iv_private.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SCAN_SSE2
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <immintrin.h>
+#define SCAN_AVX2
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SCAN_NEON
+#endif
+
+#define DEFAULT_BUF_SIZE	262144
+#define BATCH			128
+
+/* delimiter scanning *******************************************************/
+/*
+ * The scan functions find up to @max occurrences of @c among the
+ * first @len bytes at @p, store their offsets in @off, and return
+ * the number of occurrences found.  The vector versions compare a
+ * whole block at a time and then peel the matches off the resulting
+ * bitmask, so that short records don't each cost a memchr() call.
+ */
+static int scan_scalar_from(const unsigned char *p, int from, int len,
+			    unsigned char c, int *off, int max)
+{
+	const unsigned char *q;
+	int n;
+
+	q = p + from;
+	for (n = 0; n < max; n++) {
+		q = memchr(q, c, (p + len) - q);
+		if (q == NULL)
+			break;
+
+		off[n] = q - p;
+		q++;
+	}
+
+	return n;
+}
+
+static int scan_scalar(const unsigned char *p, int len,
+		       unsigned char c, int *off, int max)
+{
+	return scan_scalar_from(p, 0, len, c, off, max);
+}
+
+#ifdef SCAN_SSE2
+static int scan_sse2_from(const unsigned char *p, int from, int len,
+			  unsigned char c, int *off, int max)
+{
+	__m128i needle;
+	int n;
+	int i;
+
+	needle = _mm_set1_epi8(c);
+
+	n = 0;
+	for (i = from; i + 16 <= len; i += 16) {
+		__m128i v;
+		unsigned int mask;
+
+		v = _mm_loadu_si128((const __m128i *)(p + i));
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+
+		while (mask) {
+			off[n++] = i + __builtin_ctz(mask);
+			if (n == max)
+				return n;
+			mask &= mask - 1;
+		}
+	}
+
+	return n + scan_scalar_from(p, i, len, c, off + n, max - n);
+}
+
+static int scan_sse2(const unsigned char *p, int len,
+		     unsigned char c, int *off, int max)
+{
+	return scan_sse2_from(p, 0, len, c, off, max);
+}
+#endif
+
+#ifdef SCAN_AVX2
+__attribute__((target("avx2")))
+static int scan_avx2(const unsigned char *p, int len,
+		     unsigned char c, int *off, int max)
+{
+	__m256i needle;
+	int n;
+	int i;
+
+	needle = _mm256_set1_epi8(c);
+
+	n = 0;
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i v;
+		unsigned int mask;
+
+		v = _mm256_loadu_si256((const __m256i *)(p + i));
+		mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+
+		while (mask) {
+			off[n++] = i + __builtin_ctz(mask);
+			if (n == max)
+				return n;
+			mask &= mask - 1;
+		}
+	}
+
+	return n + scan_sse2_from(p, i, len, c, off + n, max - n);
+}
+#endif
+
+#ifdef SCAN_NEON
+static int scan_neon(const unsigned char *p, int len,
+		     unsigned char c, int *off, int max)
+{
+	uint8x16_t needle;
+	int n;
+	int i;
+
+	needle = vdupq_n_u8(c);
+
+	n = 0;
+	for (i = 0; i + 16 <= len; i += 16) {
+		uint8x16_t eq;
+		uint64_t mask;
+
+		/*
+		 * NEON has no movemask, but narrowing the comparison
+		 * result by four bits per byte gives a 64-bit mask with
+		 * one nibble per input byte.
+		 */
+		eq = vceqq_u8(vld1q_u8(p + i), needle);
+		mask = vget_lane_u64(vreinterpret_u64_u8(
+			vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+		mask &= 0x8888888888888888ULL;
+
+		while (mask) {
+			off[n++] = i + (__builtin_ctzll(mask) >> 2);
+			if (n == max)
+				return n;
+			mask &= mask - 1;
+		}
+	}
+
+	return n + scan_scalar_from(p, i, len, c, off + n, max - n);
+}
+#endif
+
+static int (*scan)(const unsigned char *p, int len,
+		   unsigned char c, int *off, int max);
+
+/*
+ * The IV_FRAMER_SCAN environment variable forces the use of a
+ * specific scan function, if it is available on this platform and
+ * CPU, so that each of them can be tested on the same host.
+ */
+static int iv_framer_force_scan(const char *name)
+{
+	if (!strcmp(name, "scalar")) {
+		scan = scan_scalar;
+		return 1;
+	}
+
+#ifdef SCAN_SSE2
+	if (!strcmp(name, "sse2")) {
+		scan = scan_sse2;
+		return 1;
+	}
+#endif
+
+#ifdef SCAN_AVX2
+	if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2")) {
+		scan = scan_avx2;
+		return 1;
+	}
+#endif
+
+#ifdef SCAN_NEON
+	if (!strcmp(name, "neon")) {
+		scan = scan_neon;
+		return 1;
+	}
+#endif
+
+	return 0;
+}
+
+static void iv_framer_init(void) __attribute__((constructor));
+static void iv_framer_init(void)
+{
+	char *force;
+
+#if defined(SCAN_AVX2)
+	__builtin_cpu_init();
+#endif
+
+	force = getenv("IV_FRAMER_SCAN");
+	if (force != NULL && getuid() != geteuid())
+		force = NULL;
+
+	if (force != NULL && iv_framer_force_scan(force))
+		return;
+
+#if defined(SCAN_AVX2)
+	if (__builtin_cpu_supports("avx2")) {
+		scan = scan_avx2;
+		return;
+	}
+#endif
+
+#if defined(SCAN_SSE2)
+	scan = scan_sse2;
+#elif defined(SCAN_NEON)
+	scan = scan_neon;
+#else
+	scan = scan_scalar;
+#endif
+}
+
+/* record splitting *********************************************************/
+/*
+ * Record handlers are allowed to unregister the framer, so after
+ * each callback we check whether that happened before touching the
+ * framer again.
+ */
+static int iv_framer_deliver(struct iv_framer *fr,
+			     const struct iv_framer_record *recs, int num)
+{
+	int dead;
+
+	dead = 0;
+	fr->dead = &dead;
+
+	fr->handler_records(fr->cookie, recs, num);
+	if (dead)
+		return -1;
+
+	fr->dead = NULL;
+
+	return 0;
+}
+
+static void iv_framer_done(struct iv_framer *fr, int err)
+{
+	iv_fd_set_handler_in(&fr->ifd, NULL);
+	fr->handler_done(fr->cookie, err);
+}
+
+static int iv_framer_split_delim(struct iv_framer *fr)
+{
+	struct iv_framer_record recs[BATCH];
+	int off[BATCH];
+
+	while (fr->scan < fr->end) {
+		int num;
+		int i;
+
+		num = scan(fr->buf + fr->scan, fr->end - fr->scan,
+			   fr->delim, off, BATCH);
+		if (num == 0) {
+			fr->scan = fr->end;
+			break;
+		}
+
+		for (i = 0; i < num; i++) {
+			int pos = fr->scan + off[i];
+
+			recs[i].data = fr->buf + fr->start;
+			recs[i].len = pos - fr->start;
+			fr->start = pos + 1;
+		}
+		fr->scan = fr->start;
+
+		if (iv_framer_deliver(fr, recs, num) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int iv_framer_split_length(struct iv_framer *fr)
+{
+	struct iv_framer_record recs[BATCH];
+	int num;
+
+	num = 0;
+	while (fr->end - fr->start >= fr->len_bytes) {
+		const unsigned char *p = fr->buf + fr->start;
+		size_t len;
+		int i;
+
+		len = 0;
+		for (i = 0; i < fr->len_bytes; i++)
+			len = (len << 8) | p[i];
+
+		if (len > fr->buf_size - fr->len_bytes) {
+			if (num && iv_framer_deliver(fr, recs, num) < 0)
+				return -1;
+			iv_framer_done(fr, EMSGSIZE);
+			return -1;
+		}
+
+		if (fr->end - fr->start - fr->len_bytes < len)
+			break;
+
+		recs[num].data = p + fr->len_bytes;
+		recs[num].len = len;
+		fr->start += fr->len_bytes + len;
+
+		if (++num == BATCH) {
+			if (iv_framer_deliver(fr, recs, num) < 0)
+				return -1;
+			num = 0;
+		}
+	}
+	fr->scan = fr->end;
+
+	if (num && iv_framer_deliver(fr, recs, num) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void iv_framer_got_eof(struct iv_framer *fr)
+{
+	struct iv_framer_record rec;
+
+	if (fr->start == fr->end) {
+		iv_framer_done(fr, 0);
+		return;
+	}
+
+	if (fr->type != IV_FRAMER_TYPE_DELIM) {
+		iv_framer_done(fr, EPROTO);
+		return;
+	}
+
+	/*
+	 * Deliver an unterminated last line as a record of its own.
+	 */
+	rec.data = fr->buf + fr->start;
+	rec.len = fr->end - fr->start;
+	fr->start = fr->end;
+	if (iv_framer_deliver(fr, &rec, 1) < 0)
+		return;
+
+	iv_framer_done(fr, 0);
+}
+
+static void iv_framer_got_in(void *_fr)
+{
+	struct iv_framer *fr = _fr;
+	int ret;
+
+	/*
+	 * Move the partial record that is left over from the previous
+	 * read (if any) to the start of the buffer.
+	 */
+	if (fr->start) {
+		fr->end -= fr->start;
+		fr->scan -= fr->start;
+		if (fr->end)
+			memmove(fr->buf, fr->buf + fr->start, fr->end);
+		fr->start = 0;
+	}
+
+	if (fr->end == fr->buf_size) {
+		iv_framer_done(fr, EMSGSIZE);
+		return;
+	}
+
+	do {
+		ret = read(fr->fd, fr->buf + fr->end, fr->buf_size - fr->end);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret <= 0) {
+		if (ret == 0)
+			iv_framer_got_eof(fr);
+		else if (errno != EAGAIN)
+			iv_framer_done(fr, errno);
+		return;
+	}
+
+	fr->end += ret;
+
+	if (fr->type == IV_FRAMER_TYPE_DELIM)
+		iv_framer_split_delim(fr);
+	else
+		iv_framer_split_length(fr);
+}
+
+/* public use ***************************************************************/
+void iv_framer_register(struct iv_framer *fr)
+{
+	if (fr->type != IV_FRAMER_TYPE_DELIM &&
+	    fr->type != IV_FRAMER_TYPE_LENGTH) {
+		iv_fatal("iv_framer_register: invalid framer type %d",
+			 fr->type);
+	}
+
+	if (fr->type == IV_FRAMER_TYPE_LENGTH &&
+	    (fr->len_bytes < 1 || fr->len_bytes > 4)) {
+		iv_fatal("iv_framer_register: invalid length prefix size %d",
+			 fr->len_bytes);
+	}
+
+	if (fr->buf_size <= 0)
+		fr->buf_size = DEFAULT_BUF_SIZE;
+
+	fr->buf = malloc(fr->buf_size);
+	if (fr->buf == NULL) {
+		iv_fatal("iv_framer_register: can't allocate %d byte "
+			 "buffer", fr->buf_size);
+	}
+	fr->start = 0;
+	fr->scan = 0;
+	fr->end = 0;
+	fr->dead = NULL;
+
+	IV_FD_INIT(&fr->ifd);
+	fr->ifd.fd = fr->fd;
+	fr->ifd.cookie = fr;
+	fr->ifd.handler_in = iv_framer_got_in;
+	iv_fd_register(&fr->ifd);
+}
+
+void iv_framer_unregister(struct iv_framer *fr)
+{
+	if (fr->dead != NULL)
+		*fr->dead = 1;
+
+	iv_fd_unregister(&fr->ifd);
+	free(fr->buf);
+}
@@ -101,6 +101,8 @@ void iv_main(void)
 		if (st->quit || !st->numobjs)
 			break;
 
+		iv_event_poll_prepare(st);
+
 		if (iv_pending_tasks(st)) {
 			_abs.tv_sec = 0;
 			_abs.tv_nsec = 0;
@@ -82,6 +82,8 @@ struct iv_timer_ {
 void iv_event_init(struct iv_state *st);
 void iv_event_deinit(struct iv_state *st);
 void iv_event_run_pending_events(void);
+void iv_event_poll_prepare(struct iv_state *st);
+void iv_event_poll_done(struct iv_state *st);
 
 /* iv_task.c */
 void iv_task_init(struct iv_state *st);
@@ -37,6 +37,8 @@ struct iv_state {
 	___mutex_t		event_list_mutex;
 	struct iv_list_head	events_pending;
 	int			event_count;
+	int			events_sleeping;
+	int			events_use_raw;
 
 	/* iv_fd.c  */
 	int			numfds;
@@ -74,6 +76,7 @@ struct iv_state {
 			struct iv_list_head	notify;
 			int			epoll_fd;
 			int			timer_fd;
+			int			event_fd;
 		} epoll;
 #endif
 
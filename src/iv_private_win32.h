@@ -32,6 +32,8 @@ struct iv_state {
 	struct iv_event_raw	events_kick;
 	___mutex_t		event_list_mutex;
 	struct iv_list_head	events_pending;
+	int			events_sleeping;
+	int			events_use_raw;
 
 	/* iv_handle.c  */
 	HANDLE			wait;
@@ -0,0 +1,505 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iv.h>
+#include <iv_list.h>
+#include <iv_stream.h>
+#include <stddef.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "iv_private.h"
+
+#define SEG_SIZE	16384
+#define MAX_IOV		64
+
+/*
+ * Queued output is kept in a chain of segments.  Small writes are
+ * appended to the tail segment, and writes that don't fit get a new
+ * segment that is at least big enough to hold the entire write, so
+ * that a single write never needs to be split over more than two
+ * segments.
+ */
+struct iv_stream_seg {
+	struct iv_list_head	list;
+	size_t			size;
+	size_t			head;
+	size_t			tail;
+	char			data[];
+};
+
+/* segment handling *********************************************************/
+static struct iv_stream_seg *seg_get(struct iv_stream *st, size_t size)
+{
+	struct iv_stream_seg *seg;
+
+	if (size <= SEG_SIZE && st->spare != NULL) {
+		seg = st->spare;
+		st->spare = NULL;
+	} else {
+		if (size < SEG_SIZE)
+			size = SEG_SIZE;
+
+		seg = malloc(offsetof(struct iv_stream_seg, data) + size);
+		if (seg == NULL)
+			return NULL;
+
+		seg->size = size;
+	}
+
+	seg->head = 0;
+	seg->tail = 0;
+
+	return seg;
+}
+
+static void seg_put(struct iv_stream *st, struct iv_stream_seg *seg)
+{
+	if (st->spare == NULL && seg->size == SEG_SIZE)
+		st->spare = seg;
+	else
+		free(seg);
+}
+
+static struct iv_stream_seg *seg_last(struct iv_stream *st)
+{
+	if (iv_list_empty(&st->segs))
+		return NULL;
+
+	return iv_list_entry(st->segs.prev, struct iv_stream_seg, list);
+}
+
+static void segs_free(struct iv_stream *st)
+{
+	struct iv_list_head *ilh;
+	struct iv_list_head *ilh2;
+
+	iv_list_for_each_safe (ilh, ilh2, &st->segs) {
+		struct iv_stream_seg *seg;
+
+		seg = iv_list_entry(ilh, struct iv_stream_seg, list);
+		iv_list_del(&seg->list);
+		free(seg);
+	}
+
+	st->queued = 0;
+}
+
+/*
+ * Drop @len bytes of written data from the head of the queue, and
+ * release the segments that were completely written.
+ */
+static void segs_consume(struct iv_stream *st, size_t len)
+{
+	st->queued -= len;
+
+	while (len) {
+		struct iv_stream_seg *seg;
+		size_t bytes;
+
+		seg = iv_list_entry(st->segs.next, struct iv_stream_seg, list);
+
+		bytes = seg->tail - seg->head;
+		if (bytes > len) {
+			seg->head += len;
+			break;
+		}
+
+		iv_list_del(&seg->list);
+		seg_put(st, seg);
+
+		len -= bytes;
+	}
+}
+
+/* output handling **********************************************************/
+static void iv_stream_got_out(void *_st);
+
+static void iv_stream_arm(struct iv_stream *st)
+{
+	if (!st->blocked) {
+		st->blocked = 1;
+		iv_fd_set_handler_out(&st->ifd, iv_stream_got_out);
+	}
+}
+
+static void iv_stream_disarm(struct iv_stream *st)
+{
+	if (st->blocked) {
+		st->blocked = 0;
+		iv_fd_set_handler_out(&st->ifd, NULL);
+	}
+}
+
+static void iv_stream_fail(struct iv_stream *st, int err)
+{
+	st->error = err;
+
+	segs_free(st);
+	if (iv_task_registered(&st->flush))
+		iv_task_unregister(&st->flush);
+	iv_stream_disarm(st);
+	iv_fd_set_handler_err(&st->ifd, NULL);
+}
+
+static ssize_t iv_stream_send(struct iv_stream *st, struct iovec *iov, int cnt)
+{
+	ssize_t ret;
+
+#ifdef MSG_NOSIGNAL
+	if (st->sock) {
+		struct msghdr msg;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = cnt;
+
+		do {
+			ret = sendmsg(st->fd, &msg, MSG_NOSIGNAL);
+		} while (ret < 0 && errno == EINTR);
+
+		return ret;
+	}
+#endif
+
+	do {
+		ret = writev(st->fd, iov, cnt);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+/*
+ * Write out as much of the queue as the kernel will take, gathering
+ * up to MAX_IOV segments into each system call.  Returns 0 if the
+ * queue was drained, 1 if output is blocked, and -1 on error.
+ */
+static int iv_stream_push(struct iv_stream *st)
+{
+	while (!iv_list_empty(&st->segs)) {
+		struct iovec iov[MAX_IOV];
+		struct iv_list_head *ilh;
+		size_t len;
+		ssize_t ret;
+		int cnt;
+
+		len = 0;
+		cnt = 0;
+		iv_list_for_each (ilh, &st->segs) {
+			struct iv_stream_seg *seg;
+
+			seg = iv_list_entry(ilh, struct iv_stream_seg, list);
+
+			iov[cnt].iov_base = seg->data + seg->head;
+			iov[cnt].iov_len = seg->tail - seg->head;
+			len += iov[cnt].iov_len;
+
+			if (++cnt == MAX_IOV)
+				break;
+		}
+
+		ret = iv_stream_send(st, iov, cnt);
+		if (ret < 0) {
+			if (errno == EAGAIN) {
+				iv_stream_arm(st);
+				return 1;
+			}
+
+			iv_stream_fail(st, errno);
+			return -1;
+		}
+
+		segs_consume(st, ret);
+
+		if ((size_t)ret < len) {
+			iv_stream_arm(st);
+			return 1;
+		}
+	}
+
+	iv_stream_disarm(st);
+
+	return 0;
+}
+
+/*
+ * If a high watermark is set, ->full tracks whether the queue has
+ * reached it without having dropped back to the low watermark since,
+ * and ->handler_full and ->handler_drained are called on those
+ * transitions.  Without one, ->handler_drained is called whenever
+ * written data empties the queue.
+ */
+static void iv_stream_check_full(struct iv_stream *st)
+{
+	if (st->high_water && !st->full && st->queued >= st->high_water) {
+		st->full = 1;
+		if (st->handler_full != NULL)
+			st->handler_full(st->cookie);
+	}
+}
+
+static void iv_stream_check_drained(struct iv_stream *st, size_t before)
+{
+	if (st->high_water) {
+		if (!st->full || st->queued > st->low_water)
+			return;
+		st->full = 0;
+	} else if (!before || st->queued) {
+		return;
+	}
+
+	if (st->handler_drained != NULL)
+		st->handler_drained(st->cookie);
+}
+
+static void iv_stream_got_out(void *_st)
+{
+	struct iv_stream *st = _st;
+	size_t before;
+	int ret;
+
+	before = st->queued;
+
+	ret = iv_stream_push(st);
+	if (ret < 0) {
+		if (st->handler_error != NULL)
+			st->handler_error(st->cookie, st->error);
+	} else {
+		iv_stream_check_drained(st, before);
+	}
+}
+
+static void iv_stream_got_in(void *_st)
+{
+	struct iv_stream *st = _st;
+
+	st->handler_in(st->cookie);
+}
+
+static void iv_stream_got_err(void *_st)
+{
+	struct iv_stream *st = _st;
+	socklen_t len;
+	int err;
+
+	/*
+	 * Let whoever is going to issue the next system call on the
+	 * file descriptor pick up the error.
+	 */
+	if (!iv_list_empty(&st->segs)) {
+		iv_stream_got_out(st);
+		return;
+	}
+
+	if (st->handler_in != NULL) {
+		st->handler_in(st->cookie);
+		return;
+	}
+
+	err = 0;
+	len = sizeof(err);
+	if (getsockopt(st->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || !err)
+		err = EPIPE;
+
+	iv_stream_fail(st, err);
+	if (st->handler_error != NULL)
+		st->handler_error(st->cookie, err);
+}
+
+/* public use ***************************************************************/
+void iv_stream_register(struct iv_stream *st)
+{
+	int type;
+	socklen_t len;
+
+	IV_FD_INIT(&st->ifd);
+	st->ifd.fd = st->fd;
+	st->ifd.cookie = st;
+	if (st->handler_in != NULL)
+		st->ifd.handler_in = iv_stream_got_in;
+	st->ifd.handler_err = iv_stream_got_err;
+	iv_fd_register(&st->ifd);
+
+	IV_TASK_INIT(&st->flush);
+	st->flush.cookie = st;
+	st->flush.handler = iv_stream_got_out;
+
+	INIT_IV_LIST_HEAD(&st->segs);
+	st->queued = 0;
+	st->spare = NULL;
+	st->blocked = 0;
+	st->full = 0;
+	st->error = 0;
+
+	len = sizeof(type);
+	st->sock = !getsockopt(st->fd, SOL_SOCKET, SO_TYPE, &type, &len);
+
+#ifdef TCP_NOTSENT_LOWAT
+	/*
+	 * Limiting the amount of unsent data that the kernel will
+	 * accept keeps the bulk of the backlog in our queue, where
+	 * iv_stream_queued() can see it.  This is expected to fail
+	 * on non-TCP sockets, which is harmless.
+	 */
+	if (st->lowat > 0 && st->sock) {
+		setsockopt(st->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+			   &st->lowat, sizeof(st->lowat));
+	}
+#endif
+}
+
+void iv_stream_unregister(struct iv_stream *st)
+{
+	segs_free(st);
+	free(st->spare);
+
+	if (iv_task_registered(&st->flush))
+		iv_task_unregister(&st->flush);
+
+	iv_fd_unregister(&st->ifd);
+}
+
+void iv_stream_set_handler_in(struct iv_stream *st,
+			      void (*handler_in)(void *cookie))
+{
+	st->handler_in = handler_in;
+	iv_fd_set_handler_in(&st->ifd,
+			     handler_in != NULL ? iv_stream_got_in : NULL);
+}
+
+int iv_stream_writev(struct iv_stream *st, const struct iovec *iov, int iovcnt)
+{
+	struct iv_stream_seg *seg;
+	struct iv_stream_seg *next;
+	size_t room;
+	size_t len;
+	int i;
+
+	if (st->error) {
+		errno = st->error;
+		return -1;
+	}
+
+	len = 0;
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	if (!len)
+		return 0;
+
+	seg = seg_last(st);
+	room = (seg != NULL) ? seg->size - seg->tail : 0;
+
+	/*
+	 * Allocate the overflow segment up front, so that we never
+	 * queue a partial write.
+	 */
+	next = NULL;
+	if (len > room) {
+		next = seg_get(st, len - room);
+		if (next == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		const char *src = iov[i].iov_base;
+		size_t bytes = iov[i].iov_len;
+
+		while (bytes) {
+			size_t chunk;
+
+			if (room == 0) {
+				iv_list_add_tail(&next->list, &st->segs);
+				seg = next;
+				room = seg->size;
+			}
+
+			chunk = (bytes < room) ? bytes : room;
+			memcpy(seg->data + seg->tail, src, chunk);
+			seg->tail += chunk;
+			room -= chunk;
+
+			src += chunk;
+			bytes -= chunk;
+		}
+	}
+
+	st->queued += len;
+
+	/*
+	 * Defer the actual write until the end of this event loop
+	 * iteration, so that everything queued in the meantime goes
+	 * out in a single system call.  If the socket is full, the
+	 * output handler will pick up the new data instead.
+	 */
+	if (!st->blocked && !iv_task_registered(&st->flush))
+		iv_task_register(&st->flush);
+
+	iv_stream_check_full(st);
+
+	return 0;
+}
+
+int iv_stream_write(struct iv_stream *st, const void *buf, size_t len)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)buf;
+	iov.iov_len = len;
+
+	return iv_stream_writev(st, &iov, 1);
+}
+
+int iv_stream_flush(struct iv_stream *st)
+{
+	size_t before;
+	int ret;
+
+	if (st->error) {
+		errno = st->error;
+		return -1;
+	}
+
+	if (iv_task_registered(&st->flush))
+		iv_task_unregister(&st->flush);
+
+	before = st->queued;
+
+	ret = iv_stream_push(st);
+	if (ret < 0) {
+		errno = st->error;
+		return ret;
+	}
+
+	iv_stream_check_drained(st, before);
+
+	return ret;
+}
+
+size_t iv_stream_queued(const struct iv_stream *st)
+{
+	return st->queued;
+}
@@ -20,7 +20,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
 #include <iv.h>
 #include <iv_event.h>
 #include <iv_list.h>
@@ -28,368 +34,1665 @@
 #include <iv_tls.h>
 #include <iv_work.h>
 #include "iv_private.h"
+#include "atomic.h"
 #include "mutex.h"
 
+#if defined(HAVE_SCHED_GETCPU) || defined(HAVE_SCHED_SETAFFINITY)
+#include <sched.h>
+#endif
+
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <dirent.h>
+#endif
+
 /* data structures **********************************************************/
+struct work_pool_queue {
+	___mutex_t		lock;
+	struct iv_list_head	work_items;
+	int			count;
+	int			head_priority;
+};
+
 struct work_pool_priv {
 	___mutex_t		lock;
 	struct iv_event		ev;
 	struct iv_event		thread_needed;
 	int			shutting_down;
+	int			min_threads;
 	int			max_threads;
 	int			started_threads;
+	int			idle_timeout_msec;
+	int			max_queue_delay_usec;
+	struct iv_timer		delay_timer;
 	struct iv_list_head	idle_threads;
 	void			*cookie;
 	void			(*thread_start)(void *cookie);
 	void			(*thread_stop)(void *cookie);
-	uint32_t		seq_head;
-	uint32_t		seq_tail;
-	struct iv_list_head	work_items;
+	int			lightweight;
+	int			pending;
+	int			prio_pending;
+	int			high_watermark;
+	int			low_watermark;
+	int			hard_limit;
+	void			(*queue_full)(void *cookie);
+	void			(*queue_drained)(void *cookie);
+	int			above_watermark;
+	struct iv_event		watermark;
+	unsigned int		next_queue;
+	int			*cpus;
+	int			num_cpus;
+	int			*cpu_node;
+	int			num_cpu_node;
+	int			*queue_node;
+	struct work_pool_thread	**threads;
+	struct work_pool_queue	*queues;
+	___mutex_t		done_lock;
 	struct iv_list_head	work_done;
 	unsigned long		tid;
 };
 
+struct work_sink {
+	___mutex_t		lock;
+	struct iv_list_head	work_done;
+	struct iv_event		ev;
+	int			outstanding;
+	int			registered;
+};
+
 struct work_pool_thread {
 	struct work_pool_priv	*pool;
+	int			index;
 	struct iv_list_head	list;
 	int			kicked;
 	struct iv_event		kick;
 	struct iv_timer		idle_timer;
+#ifndef _WIN32
+	pthread_cond_t		cond;
+#endif
 };
 
 
-/* worker thread ************************************************************/
-static void __iv_work_thread_die(struct work_pool_thread *thr)
+/*
+ * Work items are distributed round-robin over per-thread queues,
+ * each of which has its own lock, and a worker thread that runs out
+ * of work in its own queue will try to steal work from the queues
+ * of the other threads before going idle.  The pool lock is only
+ * taken to manage the set of (idle) threads, and not for every work
+ * item that is processed.
+ *
+ * ->pending counts the work items that are sitting in any of the
+ * queues (it is incremented before an item is queued and decremented
+ * after it is dequeued, so it never undercounts).  It is modified
+ * atomically, but a thread that is about to go idle reads it while
+ * holding the pool lock, which is also taken by submitters after
+ * queueing their work item, so that either the idling thread sees
+ * the new work item, or the submitter sees the idle thread and
+ * kicks it.
+ *
+ * ->count mirrors the number of work items on each queue's list.  It
+ * is only modified while holding the queue lock, but is read without
+ * it (atomically) by threads scanning the queues for work, so that
+ * they don't need to take the lock of every empty queue they look at.
+ *
+ * Each queue is kept sorted by descending priority, and is FIFO
+ * among items of equal priority.  ->prio_pending counts the queued
+ * work items with a nonzero priority, and as long as there are any
+ * of those, workers look at the ->head_priority of all queues to
+ * pick the most urgent work item rather than just taking from their
+ * own queue first.
+ *
+ * If the pool has a high watermark, every update of ->pending that
+ * crosses the high watermark from below or the low watermark from
+ * above triggers a re-evaluation of the watermark state in the thread
+ * owning the pool (directly, if the update happened in that thread,
+ * or else by way of the ->watermark event).  ->above_watermark is
+ * only accessed from the owning thread.
+ */
+static int work_pool_crossed(struct work_pool_priv *pool, int old, int delta)
 {
-	struct work_pool_priv *pool = thr->pool;
-
-	if (thr->kicked)
-		iv_fatal("__iv_work_thread_die: called on kicked thread");
+	if (!pool->high_watermark)
+		return 0;
 
-	if (!iv_list_empty(&thr->list))
-		iv_fatal("__iv_work_thread_die: thread still on list");
+	if (delta > 0) {
+		return old < pool->high_watermark &&
+			old + delta >= pool->high_watermark;
+	}
 
-	iv_event_unregister(&thr->kick);
-	free(thr);
+	return old > pool->low_watermark && old + delta <= pool->low_watermark;
+}
 
-	pool->started_threads--;
+static int work_pool_pending_add(struct work_pool_priv *pool, int delta)
+{
+	int old;
 
-	if (pool->thread_stop != NULL)
-		pool->thread_stop(pool->cookie);
+	old = atomic_fetch_add(&pool->pending, delta);
 
-	if (pool->shutting_down && !pool->started_threads)
-		iv_event_post(&pool->ev);
+	return work_pool_crossed(pool, old, delta);
 }
 
-static void iv_work_thread_got_event(void *_thr)
+/*
+ * With IV_WORK_POOL_FLAG_HARD_LIMIT, submissions that would take
+ * ->pending above the high watermark are refused.  The new items are
+ * accounted for first and backed out again if they don't fit, so that
+ * concurrent submitters can never push ->pending past the limit.
+ */
+static int
+work_pool_pending_reserve(struct work_pool_priv *pool, int num, int *crossed)
 {
-	struct work_pool_thread *thr = _thr;
-	struct work_pool_priv *pool = thr->pool;
-	uint32_t last_seq;
+	int old;
 
-	___mutex_lock(&pool->lock);
-
-	thr->kicked = 0;
-
-	if (!iv_list_empty(&thr->list)) {
-		iv_list_del_init(&thr->list);
-		iv_timer_unregister(&thr->idle_timer);
+	old = atomic_fetch_add(&pool->pending, num);
+	if (pool->hard_limit && old + num > pool->high_watermark) {
+		*crossed = work_pool_pending_add(pool, -num);
+		return -1;
 	}
 
-	last_seq = pool->seq_tail;
-	while ((int32_t)(last_seq - pool->seq_head) > 0) {
-		struct iv_work_item *work;
+	*crossed = work_pool_crossed(pool, old, num);
 
-		pool->seq_head++;
-		work = iv_container_of(pool->work_items.next,
-				       struct iv_work_item, list);
-		iv_list_del(&work->list);
+	return 0;
+}
 
-		___mutex_unlock(&pool->lock);
-		work->work(work->cookie);
-		iv_invalidate_now();
-		___mutex_lock(&pool->lock);
+static void
+work_pool_queue_insert(struct work_pool_queue *q, struct iv_work_item *work)
+{
+	struct iv_list_head *ilh;
 
-		if (iv_list_empty(&pool->work_done))
-			iv_event_post(&pool->ev);
-		iv_list_add_tail(&work->list, &pool->work_done);
-	}
+	for (ilh = q->work_items.prev; ilh != &q->work_items; ilh = ilh->prev) {
+		struct iv_work_item *w;
 
-	if (pool->seq_head == pool->seq_tail) {
-		if (!pool->shutting_down) {
-			iv_list_add(&thr->list, &pool->idle_threads);
-			iv_validate_now();
-			thr->idle_timer.expires = iv_now;
-			thr->idle_timer.expires.tv_sec += 10;
-			iv_timer_register(&thr->idle_timer);
-		} else {
-			__iv_work_thread_die(thr);
-		}
-	} else {
-		/*
-		 * If we're already at the maximum number of pool
-		 * threads, and none of those threads were idle when
-		 * more work arrived, then there may have been no
-		 * kick sent for the new work item(s) (and no new
-		 * pool thread started either), so if we're leaving
-		 * with work items still pending, make sure we get
-		 * called again, so that we don't deadlock.
-		 */
-		iv_event_post(&thr->kick);
+		w = iv_container_of(ilh, struct iv_work_item, list);
+		if (w->priority >= work->priority)
+			break;
 	}
+	iv_list_add(&work->list, ilh);
+	atomic_store_relaxed(&work->queue, q);
+	atomic_store_relaxed(&q->count, q->count + 1);
 
-	___mutex_unlock(&pool->lock);
+	if (q->work_items.next == &work->list)
+		atomic_store_relaxed(&q->head_priority, work->priority);
 }
 
-static void iv_work_thread_idle_timeout(void *_thr)
+static void
+work_pool_queue_unlink(struct work_pool_queue *q, struct iv_work_item *work)
 {
-	struct work_pool_thread *thr = _thr;
-	struct work_pool_priv *pool = thr->pool;
+	int was_head = (q->work_items.next == &work->list);
 
-	___mutex_lock(&pool->lock);
-	
-	if (thr->kicked) {
-		thr->idle_timer.expires = iv_now;
-		thr->idle_timer.expires.tv_sec += 10;
-		iv_timer_register(&thr->idle_timer);
-	} else {
-		iv_list_del_init(&thr->list);
-		__iv_work_thread_die(thr);
-	}
+	iv_list_del(&work->list);
+	atomic_store_relaxed(&work->queue, NULL);
+	atomic_store_relaxed(&q->count, q->count - 1);
 
-	___mutex_unlock(&pool->lock);
+	if (was_head && !iv_list_empty(&q->work_items)) {
+		struct iv_work_item *next;
+
+		next = iv_container_of(q->work_items.next,
+				       struct iv_work_item, list);
+		atomic_store_relaxed(&q->head_priority, next->priority);
+	}
 }
 
-static void iv_work_thread(void *_thr)
+/*
+ * If the pool threads are pinned to CPUs on more than one NUMA node,
+ * ->queue_node gives the node of the thread serving each queue, and
+ * work items are preferentially queued to threads on the node of the
+ * submitting thread.
+ */
+static int work_pool_pick_queue(struct work_pool_priv *pool)
 {
-	struct work_pool_thread *thr = _thr;
-	struct work_pool_priv *pool = thr->pool;
+	int index;
 
-	iv_init();
+	index = atomic_fetch_add(&pool->next_queue, 1) % pool->max_threads;
 
-	INIT_IV_LIST_HEAD(&thr->list);
+#ifdef HAVE_SCHED_GETCPU
+	if (pool->queue_node != NULL) {
+		int cpu;
+		int node;
+		int i;
 
-	thr->kicked = 0;
+		cpu = sched_getcpu();
+		if (cpu < 0 || cpu >= pool->num_cpu_node)
+			return index;
 
-	IV_EVENT_INIT(&thr->kick);
-	thr->kick.cookie = thr;
-	thr->kick.handler = iv_work_thread_got_event;
-	iv_event_register(&thr->kick);
+		node = pool->cpu_node[cpu];
+		for (i = 0; i < pool->max_threads; i++) {
+			int j = (index + i) % pool->max_threads;
 
-	IV_TIMER_INIT(&thr->idle_timer);
-	thr->idle_timer.cookie = thr;
-	thr->idle_timer.handler = iv_work_thread_idle_timeout;
+			if (pool->queue_node[j] == node)
+				return j;
+		}
+	}
+#endif
 
-	if (pool->thread_start != NULL)
-		pool->thread_start(pool->cookie);
+	return index;
+}
 
-	iv_event_post(&thr->kick);
+static int
+work_pool_queue_add(struct work_pool_priv *pool, struct iv_work_item *work)
+{
+	struct work_pool_queue *q;
+	int index;
 
-	iv_main();
+	if (work->priority)
+		atomic_fetch_add(&pool->prio_pending, 1);
 
-	iv_deinit();
-}
+	index = work_pool_pick_queue(pool);
+	q = &pool->queues[index];
 
+	___mutex_lock(&q->lock);
+	work_pool_queue_insert(q, work);
+	___mutex_unlock(&q->lock);
 
-/* main thread **************************************************************/
-static void iv_work_event(void *_pool)
+	return index;
+}
+
+static struct iv_work_item *
+work_pool_queue_get(struct work_pool_priv *pool, int index)
 {
-	struct work_pool_priv *pool = _pool;
-	struct iv_list_head items;
+	struct work_pool_queue *q = &pool->queues[index];
+	struct iv_work_item *work;
 
-	___mutex_lock(&pool->lock);
-	__iv_list_steal_elements(&pool->work_done, &items);
-	___mutex_unlock(&pool->lock);
+	if (!atomic_load_relaxed(&q->count))
+		return NULL;
 
-	while (!iv_list_empty(&items)) {
-		struct iv_work_item *work;
+	___mutex_lock(&q->lock);
+	if (iv_list_empty(&q->work_items)) {
+		___mutex_unlock(&q->lock);
+		return NULL;
+	}
 
-		work = iv_container_of(items.next, struct iv_work_item, list);
-		iv_list_del(&work->list);
+	work = iv_container_of(q->work_items.next, struct iv_work_item, list);
+	work_pool_queue_unlink(q, work);
+	___mutex_unlock(&q->lock);
 
-		work->completion(work->cookie);
-	}
+	if (work_pool_pending_add(pool, -1))
+		iv_event_post(&pool->watermark);
+	if (work->priority)
+		atomic_fetch_add(&pool->prio_pending, -1);
 
-	if (pool->shutting_down) {
-		___mutex_lock(&pool->lock);
-		if (!pool->started_threads && iv_list_empty(&pool->work_done)) {
-			___mutex_unlock(&pool->lock);
-			___mutex_destroy(&pool->lock);
-			iv_event_unregister(&pool->ev);
-			iv_event_unregister(&pool->thread_needed);
-			free(pool);
-			return;
+	return work;
+}
+
+static struct iv_work_item *
+work_pool_dequeue_urgent(struct work_pool_thread *thr)
+{
+	struct work_pool_priv *pool = thr->pool;
+	int best_index;
+	int best_priority;
+	int i;
+
+	best_index = -1;
+	best_priority = INT_MIN;
+	for (i = 0; i < pool->max_threads; i++) {
+		struct work_pool_queue *q;
+		int index;
+		int priority;
+
+		index = (thr->index + i) % pool->max_threads;
+		q = &pool->queues[index];
+		if (!atomic_load_relaxed(&q->count))
+			continue;
+
+		priority = atomic_load_relaxed(&q->head_priority);
+		if (best_index == -1 || priority > best_priority) {
+			best_index = index;
+			best_priority = priority;
 		}
-		___mutex_unlock(&pool->lock);
 	}
-}
 
-static int iv_work_start_thread(struct work_pool_priv *pool);
+	if (best_index == -1)
+		return NULL;
 
-static void iv_work_thread_needed(void *_pool)
+	return work_pool_queue_get(pool, best_index);
+}
+
+/*
+ * Take a work item from another thread's queue, looking only at the
+ * queues of threads on the same NUMA node (@same_node == 1), only on
+ * other nodes (0), or at all queues (-1).
+ */
+static struct iv_work_item *
+work_pool_steal(struct work_pool_thread *thr, int same_node)
 {
-	struct work_pool_priv *pool = _pool;
+	struct work_pool_priv *pool = thr->pool;
+	int i;
 
-	___mutex_lock(&pool->lock);
+	for (i = 1; i < pool->max_threads; i++) {
+		struct iv_work_item *work;
+		int index;
 
-	if (iv_list_empty(&pool->idle_threads) && 
-	    pool->started_threads < pool->max_threads) {
-		iv_work_start_thread(pool);
+		if (!atomic_load_relaxed(&pool->pending))
+			break;
+
+		index = (thr->index + i) % pool->max_threads;
+
+		if (same_node != -1 &&
+		    (pool->queue_node[index] == pool->queue_node[thr->index])
+		    != same_node) {
+			continue;
+		}
+
+		work = work_pool_queue_get(pool, index);
+		if (work != NULL)
+			return work;
 	}
 
-	___mutex_unlock(&pool->lock);
+	return NULL;
 }
 
-int iv_work_pool_create(struct iv_work_pool *this)
+static struct iv_work_item *work_pool_dequeue(struct work_pool_thread *thr)
 {
-	struct work_pool_priv *pool;
-	int ret;
-
-	pool = malloc(sizeof(*pool));
-	if (pool == NULL)
-		return -1;
+	struct work_pool_priv *pool = thr->pool;
+	struct iv_work_item *work;
 
-	ret = ___mutex_init(&pool->lock);
-	if (ret) {
-		free(pool);
-		return -1;
+	if (atomic_load_relaxed(&pool->prio_pending)) {
+		work = work_pool_dequeue_urgent(thr);
+		if (work != NULL)
+			return work;
 	}
 
-	IV_EVENT_INIT(&pool->ev);
-	pool->ev.cookie = pool;
-	pool->ev.handler = iv_work_event;
-	iv_event_register(&pool->ev);
-
-	IV_EVENT_INIT(&pool->thread_needed);
-	pool->thread_needed.cookie = pool;
-	pool->thread_needed.handler = iv_work_thread_needed;
-	iv_event_register(&pool->thread_needed);
-
-	pool->max_threads = this->max_threads;
-	pool->shutting_down = 0;
-	pool->started_threads = 0;
-	INIT_IV_LIST_HEAD(&pool->idle_threads);
-	pool->cookie = this->cookie;
-	pool->thread_start = this->thread_start;
-	pool->thread_stop = this->thread_stop;
-	pool->seq_head = 0;
-	pool->seq_tail = 0;
-	INIT_IV_LIST_HEAD(&pool->work_items);
-	INIT_IV_LIST_HEAD(&pool->work_done);
+	work = work_pool_queue_get(pool, thr->index);
+	if (work != NULL)
+		return work;
 
-	pool->tid = iv_get_thread_id();
+	if (pool->queue_node != NULL) {
+		work = work_pool_steal(thr, 1);
+		if (work != NULL)
+			return work;
 
-	this->priv = pool;
+		return work_pool_steal(thr, 0);
+	}
 
-	return 0;
+	return work_pool_steal(thr, -1);
 }
 
-void iv_work_pool_put(struct iv_work_pool *this)
+
+/* cpu affinity and numa ****************************************************/
+#ifdef HAVE_SCHED_SETAFFINITY
+static int iv_work_read_cpulist(const char *path, int **_cpus)
 {
-	struct work_pool_priv *pool = this->priv;
-	struct iv_list_head *ilh;
+	FILE *fp;
+	int *cpus;
+	int num;
+	int size;
+	int a;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
 
-	___mutex_lock(&pool->lock);
+	cpus = NULL;
+	num = 0;
+	size = 0;
+
+	/*
+	 * The list is in the "0-3,8-11" format used by sysfs.
+	 */
+	while (fscanf(fp, "%d", &a) == 1) {
+		int b;
+		int c;
+
+		b = a;
+		c = fgetc(fp);
+		if (c == '-') {
+			if (fscanf(fp, "%d", &b) != 1)
+				break;
+			c = fgetc(fp);
+		}
 
-	this->priv = NULL;
-	pool->shutting_down = 1;
+		for (; a <= b; a++) {
+			if (num == size) {
+				int *new;
+
+				size = size ? 2 * size : 16;
+				new = realloc(cpus, size * sizeof(*cpus));
+				if (new == NULL) {
+					free(cpus);
+					fclose(fp);
+					return -1;
+				}
+				cpus = new;
+			}
+			cpus[num++] = a;
+		}
 
-	if (!pool->started_threads) {
-		___mutex_unlock(&pool->lock);
-		iv_event_post(&pool->ev);
-		return;
+		if (c != ',')
+			break;
 	}
 
-	iv_list_for_each (ilh, &pool->idle_threads) {
-		struct work_pool_thread *thr;
+	fclose(fp);
 
-		thr = iv_container_of(ilh, struct work_pool_thread, list);
-		iv_event_post(&thr->kick);
-	}
+	*_cpus = cpus;
 
-	___mutex_unlock(&pool->lock);
+	return num;
 }
 
-static int iv_work_start_thread(struct work_pool_priv *pool)
+static void iv_work_pool_map_nodes(struct work_pool_priv *pool)
 {
-	struct work_pool_thread *thr;
-	char name[512];
-	int ret;
+	DIR *dir;
+	struct dirent *de;
+	int *cpu_node;
+	int num_cpu_node;
+	int i;
+
+	dir = opendir("/sys/devices/system/node");
+	if (dir == NULL)
+		return;
 
-	thr = malloc(sizeof(*thr));
-	if (thr == NULL)
-		return -1;
+	cpu_node = NULL;
+	num_cpu_node = 0;
 
-	thr->pool = pool;
+	while ((de = readdir(dir)) != NULL) {
+		char path[256];
+		int node;
+		int *cpus;
+		int num;
 
-	snprintf(name, sizeof(name), "iv_work pool %p thread %p", pool, thr);
+		if (sscanf(de->d_name, "node%d", &node) != 1)
+			continue;
 
-	ret = iv_thread_create(name, iv_work_thread, thr);
-	if (ret < 0) {
-		free(thr);
-		return -1;
-	}
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/node/node%d/cpulist", node);
 
-	pool->started_threads++;
+		num = iv_work_read_cpulist(path, &cpus);
+		if (num <= 0)
+			continue;
 
-	return 0;
-}
+		for (i = 0; i < num; i++) {
+			if (cpus[i] >= num_cpu_node) {
+				int *new;
+				int j;
 
-static void iv_work_submit_pool(struct iv_work_pool *this,
-				struct iv_work_item *work, int continuation)
-{
-	struct work_pool_priv *pool = this->priv;
-	int called_from_owner_thread = (pool->tid == iv_get_thread_id());
+				new = realloc(cpu_node,
+					      (cpus[i] + 1) * sizeof(*cpu_node));
+				if (new == NULL)
+					continue;
 
-	if (!continuation && !called_from_owner_thread) {
-		iv_fatal("iv_work_submit_pool: work items can only be "
-			 "submitted from the owning thread");
+				for (j = num_cpu_node; j <= cpus[i]; j++)
+					new[j] = -1;
+
+				cpu_node = new;
+				num_cpu_node = cpus[i] + 1;
+			}
+			cpu_node[cpus[i]] = node;
+		}
+
+		free(cpus);
 	}
 
-	___mutex_lock(&pool->lock);
+	closedir(dir);
 
-	pool->seq_tail++;
-	iv_list_add_tail(&work->list, &pool->work_items);
+	if (cpu_node == NULL)
+		return;
 
-	if (!iv_list_empty(&pool->idle_threads)) {
-		struct work_pool_thread *thr;
+	pool->queue_node = malloc(pool->max_threads * sizeof(int));
+	if (pool->queue_node == NULL) {
+		free(cpu_node);
+		return;
+	}
 
-		thr = iv_container_of(pool->idle_threads.next,
-				      struct work_pool_thread, list);
-		thr->kicked = 1;
-		iv_event_post(&thr->kick);
-	} else if (pool->started_threads < this->max_threads) {
-		if (called_from_owner_thread)
-			iv_work_start_thread(pool);
+	for (i = 0; i < pool->max_threads; i++) {
+		int cpu = pool->cpus[i % pool->num_cpus];
+
+		if (cpu >= 0 && cpu < num_cpu_node)
+			pool->queue_node[i] = cpu_node[cpu];
 		else
-			iv_event_post(&pool->thread_needed);
+			pool->queue_node[i] = -1;
 	}
 
-	___mutex_unlock(&pool->lock);
-}
+	/*
+	 * Node affinity is only worth tracking if the pool spans
+	 * more than one node.
+	 */
+	for (i = 1; i < pool->max_threads; i++) {
+		if (pool->queue_node[i] != pool->queue_node[0])
+			break;
+	}
 
-struct iv_work_thr_info {
-	struct iv_task		task;
-	struct iv_list_head	work_items;
-};
+	if (i == pool->max_threads) {
+		free(pool->queue_node);
+		pool->queue_node = NULL;
+		free(cpu_node);
+		return;
+	}
 
-static void iv_work_handle_local(void *_tinfo);
+	pool->cpu_node = cpu_node;
+	pool->num_cpu_node = num_cpu_node;
+}
 
-static void iv_work_tls_init_thread(void *_tinfo)
+static int iv_work_pool_init_affinity(struct work_pool_priv *pool,
+				      struct iv_work_pool *this)
 {
-	struct iv_work_thr_info *tinfo = _tinfo;
+	if (this->num_cpus > 0) {
+		pool->cpus = malloc(this->num_cpus * sizeof(int));
+		if (pool->cpus == NULL)
+			return -1;
+
+		memcpy(pool->cpus, this->cpus, this->num_cpus * sizeof(int));
+		pool->num_cpus = this->num_cpus;
+	} else if (this->numa_node >= 0) {
+		char path[256];
+		int num;
+
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/node/node%d/cpulist",
+			 this->numa_node);
+
+		num = iv_work_read_cpulist(path, &pool->cpus);
+		if (num <= 0)
+			return -1;
+
+		pool->num_cpus = num;
+	} else {
+		return 0;
+	}
 
-	IV_TASK_INIT(&tinfo->task);
-	tinfo->task.cookie = tinfo;
-	tinfo->task.handler = iv_work_handle_local;
+	iv_work_pool_map_nodes(pool);
 
-	INIT_IV_LIST_HEAD(&tinfo->work_items);
+	return 0;
 }
 
-static struct iv_tls_user iv_work_tls_user = {
-	.sizeof_state	= sizeof(struct iv_work_thr_info),
-	.init_thread	= iv_work_tls_init_thread,
-};
+static void iv_work_thread_set_affinity(struct work_pool_thread *thr)
+{
+	struct work_pool_priv *pool = thr->pool;
+	cpu_set_t set;
+	int cpu;
+
+	if (!pool->num_cpus)
+		return;
+
+	cpu = pool->cpus[thr->index % pool->num_cpus];
+	if (cpu < 0 || cpu >= CPU_SETSIZE)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	/*
+	 * Failing to pin a thread (for example because the CPU has
+	 * been taken offline or is not in our cpuset) is not fatal.
+	 */
+	sched_setaffinity(0, sizeof(set), &set);
+}
+#else
+static int iv_work_pool_init_affinity(struct work_pool_priv *pool,
+				      struct iv_work_pool *this)
+{
+	if (this->num_cpus > 0 || this->numa_node >= 0)
+		return -1;
+
+	return 0;
+}
+
+static void iv_work_thread_set_affinity(struct work_pool_thread *thr)
+{
+}
+#endif
+
+
+/* completion sinks *********************************************************/
+/*
+ * A completion sink collects completed work items whose completion
+ * callbacks need to run in a thread other than the thread owning the
+ * pool.  Each ivykis thread has an implicit sink, which is used for
+ * work items submitted from that thread, and whose event is only
+ * registered while there are work items outstanding for it (so that
+ * it keeps the thread's event loop alive for exactly as long as
+ * needed), and users can register explicit sinks by way of struct
+ * iv_work_loop.
+ */
+static void iv_work_sink_run(void *_sink)
+{
+	struct work_sink *sink = _sink;
+	struct iv_list_head items;
+
+	___mutex_lock(&sink->lock);
+	__iv_list_steal_elements(&sink->work_done, &items);
+	___mutex_unlock(&sink->lock);
+
+	while (!iv_list_empty(&items)) {
+		struct iv_work_item *work;
+
+		work = iv_container_of(items.next, struct iv_work_item, list);
+		iv_list_del(&work->list);
+
+		if (sink->outstanding)
+			sink->outstanding--;
+
+		work->completion(work->cookie);
+	}
+
+	if (sink->registered == 1 && !sink->outstanding) {
+		iv_event_unregister(&sink->ev);
+		sink->registered = 0;
+	}
+}
+
+static int iv_work_sink_init(struct work_sink *sink)
+{
+	if (___mutex_init(&sink->lock))
+		return -1;
+
+	INIT_IV_LIST_HEAD(&sink->work_done);
+
+	IV_EVENT_INIT(&sink->ev);
+	sink->ev.cookie = sink;
+	sink->ev.handler = iv_work_sink_run;
+
+	sink->outstanding = 0;
+	sink->registered = 0;
+
+	return 0;
+}
+
+static void
+iv_work_sink_add(struct work_sink *sink, struct iv_work_item *work)
+{
+	int post;
+
+	___mutex_lock(&sink->lock);
+	post = iv_list_empty(&sink->work_done);
+	iv_list_add_tail(&work->list, &sink->work_done);
+	___mutex_unlock(&sink->lock);
+
+	if (post)
+		iv_event_post(&sink->ev);
+}
+
+int iv_work_loop_register(struct iv_work_loop *this)
+{
+	struct work_sink *sink;
+
+	sink = malloc(sizeof(*sink));
+	if (sink == NULL)
+		return -1;
+
+	if (iv_work_sink_init(sink)) {
+		free(sink);
+		return -1;
+	}
+
+	/*
+	 * ->registered == 2 marks an explicitly registered sink, whose
+	 * event stays registered until iv_work_loop_unregister().
+	 */
+	iv_event_register(&sink->ev);
+	sink->registered = 2;
+
+	this->priv = sink;
+
+	return 0;
+}
+
+void iv_work_loop_unregister(struct iv_work_loop *this)
+{
+	struct work_sink *sink = this->priv;
+
+	iv_event_unregister(&sink->ev);
+	___mutex_destroy(&sink->lock);
+	free(sink);
+
+	this->priv = NULL;
+}
+
+
+/* worker thread ************************************************************/
+static void __iv_work_thread_die(struct work_pool_thread *thr)
+{
+	struct work_pool_priv *pool = thr->pool;
+
+	if (thr->kicked)
+		iv_fatal("__iv_work_thread_die: called on kicked thread");
+
+	if (!iv_list_empty(&thr->list))
+		iv_fatal("__iv_work_thread_die: thread still on list");
+
+#ifndef _WIN32
+	if (pool->lightweight)
+		pthr_cond_destroy(&thr->cond);
+	else
+#endif
+		iv_event_unregister(&thr->kick);
+	pool->threads[thr->index] = NULL;
+	free(thr);
+
+	pool->started_threads--;
+
+	if (pool->thread_stop != NULL)
+		pool->thread_stop(pool->cookie);
+
+	if (pool->shutting_down && !pool->started_threads)
+		iv_event_post(&pool->ev);
+}
+
+static void iv_work_thread_kick(struct work_pool_thread *thr)
+{
+#ifndef _WIN32
+	if (thr->pool->lightweight) {
+		pthr_cond_signal(&thr->cond);
+		return;
+	}
+#endif
+	iv_event_post(&thr->kick);
+}
+
+static int iv_work_item_expired(struct iv_work_item *work)
+{
+	struct timespec now;
+
+	if (!work->deadline.tv_sec && !work->deadline.tv_nsec)
+		return 0;
+
+	iv_time_get(&now);
+
+	return timespec_gt(&now, &work->deadline);
+}
+
+static void iv_work_run_item(struct work_pool_priv *pool,
+			     struct iv_work_item *work)
+{
+	int post;
+
+	work->timed_out = iv_work_item_expired(work);
+	if (!work->timed_out) {
+		work->work(work->cookie);
+		if (!pool->lightweight)
+			iv_invalidate_now();
+	}
+
+	if (work->flags & IV_WORK_ITEM_FLAG_INLINE_COMPLETION) {
+		work->completion(work->cookie);
+		return;
+	}
+
+	if (work->completion_sink != NULL) {
+		iv_work_sink_add(work->completion_sink, work);
+		return;
+	}
+
+	___mutex_lock(&pool->done_lock);
+	post = iv_list_empty(&pool->work_done);
+	iv_list_add_tail(&work->list, &pool->work_done);
+	___mutex_unlock(&pool->done_lock);
+
+	if (post)
+		iv_event_post(&pool->ev);
+}
+
+/*
+ * If the pool has a queue delay target, work items are timestamped
+ * when they are submitted, so that the thread owning the pool can
+ * tell how long the oldest queued work item has been waiting.
+ */
+static void iv_work_stamp_item(struct work_pool_priv *pool,
+			       struct iv_work_item *work)
+{
+	if (pool->max_queue_delay_usec)
+		iv_time_get(&work->submitted);
+}
+
+static int iv_work_thread_run_one(struct work_pool_thread *thr)
+{
+	struct work_pool_priv *pool = thr->pool;
+	struct iv_work_item *work;
+
+	work = work_pool_dequeue(thr);
+	if (work == NULL)
+		return 0;
+
+	iv_work_run_item(pool, work);
+
+	return 1;
+}
+
+static void iv_work_thread_arm_idle_timer(struct work_pool_thread *thr)
+{
+	int msec = thr->pool->idle_timeout_msec;
+
+	iv_validate_now();
+	thr->idle_timer.expires = iv_now;
+	thr->idle_timer.expires.tv_sec += msec / 1000;
+	thr->idle_timer.expires.tv_nsec += 1000000L * (msec % 1000);
+	if (thr->idle_timer.expires.tv_nsec >= 1000000000L) {
+		thr->idle_timer.expires.tv_sec++;
+		thr->idle_timer.expires.tv_nsec -= 1000000000L;
+	}
+	iv_timer_register(&thr->idle_timer);
+}
+
+static void iv_work_thread_got_event(void *_thr)
+{
+	struct work_pool_thread *thr = _thr;
+	struct work_pool_priv *pool = thr->pool;
+	int budget;
+
+	___mutex_lock(&pool->lock);
+
+	thr->kicked = 0;
+
+	if (!iv_list_empty(&thr->list)) {
+		iv_list_del_init(&thr->list);
+		iv_timer_unregister(&thr->idle_timer);
+	}
+
+	budget = atomic_load_relaxed(&pool->pending);
+
+	___mutex_unlock(&pool->lock);
+
+	/*
+	 * Process at most as many work items as there were pending
+	 * when we were kicked (but at least one), so that we get back
+	 * to our event loop every now and then.
+	 */
+	do {
+		if (!iv_work_thread_run_one(thr))
+			break;
+	} while (--budget > 0);
+
+	___mutex_lock(&pool->lock);
+
+	if (atomic_load_relaxed(&pool->pending)) {
+		/*
+		 * There is more work to do, either because we ran out
+		 * of budget, or because more work arrived while all
+		 * pool threads were busy (in which case no kick may
+		 * have been sent for it), so make sure we get called
+		 * again, so that we don't deadlock.
+		 */
+		iv_event_post(&thr->kick);
+	} else if (!pool->shutting_down) {
+		iv_list_add(&thr->list, &pool->idle_threads);
+		iv_work_thread_arm_idle_timer(thr);
+	} else {
+		__iv_work_thread_die(thr);
+	}
+
+	___mutex_unlock(&pool->lock);
+}
+
+static void iv_work_thread_idle_timeout(void *_thr)
+{
+	struct work_pool_thread *thr = _thr;
+	struct work_pool_priv *pool = thr->pool;
+
+	___mutex_lock(&pool->lock);
+
+	if (thr->kicked || pool->started_threads <= pool->min_threads) {
+		iv_work_thread_arm_idle_timer(thr);
+	} else {
+		iv_list_del_init(&thr->list);
+		__iv_work_thread_die(thr);
+	}
+
+	___mutex_unlock(&pool->lock);
+}
+
+static void iv_work_thread(void *_thr)
+{
+	struct work_pool_thread *thr = _thr;
+	struct work_pool_priv *pool = thr->pool;
+
+	iv_work_thread_set_affinity(thr);
+
+	iv_init();
+
+	IV_EVENT_INIT(&thr->kick);
+	thr->kick.cookie = thr;
+	thr->kick.handler = iv_work_thread_got_event;
+	iv_event_register(&thr->kick);
+
+	IV_TIMER_INIT(&thr->idle_timer);
+	thr->idle_timer.cookie = thr;
+	thr->idle_timer.handler = iv_work_thread_idle_timeout;
+
+	if (pool->thread_start != NULL)
+		pool->thread_start(pool->cookie);
+
+	iv_event_post(&thr->kick);
+
+	iv_main();
+
+	iv_deinit();
+}
+
+#ifndef _WIN32
+/*
+ * Lightweight pool threads do not run an ivykis event loop of their
+ * own, but park on a per-thread condition variable (protected by the
+ * pool lock) while idle, and are kicked by signalling it.
+ */
+static void iv_work_thread_lightweight(void *_thr)
+{
+	struct work_pool_thread *thr = _thr;
+	struct work_pool_priv *pool = thr->pool;
+
+	iv_work_thread_set_affinity(thr);
+
+	if (pool->thread_start != NULL)
+		pool->thread_start(pool->cookie);
+
+	___mutex_lock(&pool->lock);
+
+	while (1) {
+		struct timeval now;
+		struct timespec deadline;
+		int ret;
+
+		thr->kicked = 0;
+
+		___mutex_unlock(&pool->lock);
+		while (iv_work_thread_run_one(thr))
+			;
+		___mutex_lock(&pool->lock);
+
+		if (atomic_load_relaxed(&pool->pending))
+			continue;
+
+		if (pool->shutting_down)
+			break;
+
+		iv_list_add(&thr->list, &pool->idle_threads);
+
+		ret = 0;
+		while (!thr->kicked && !pool->shutting_down) {
+			if (ret == ETIMEDOUT) {
+				if (pool->started_threads > pool->min_threads)
+					break;
+				ret = 0;
+			}
+
+			gettimeofday(&now, NULL);
+			deadline.tv_sec = now.tv_sec +
+				pool->idle_timeout_msec / 1000;
+			deadline.tv_nsec = 1000 * now.tv_usec +
+				1000000L * (pool->idle_timeout_msec % 1000);
+			if (deadline.tv_nsec >= 1000000000L) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+
+			while (!thr->kicked && !pool->shutting_down &&
+			       ret != ETIMEDOUT) {
+				ret = pthr_cond_timedwait(&thr->cond,
+							  &pool->lock,
+							  &deadline);
+			}
+		}
+
+		iv_list_del_init(&thr->list);
+
+		if (!thr->kicked && !pool->shutting_down)
+			break;
+	}
+
+	__iv_work_thread_die(thr);
+
+	___mutex_unlock(&pool->lock);
+}
+#endif
+
+
+/* main thread **************************************************************/
+static void iv_work_pool_free(struct work_pool_priv *pool)
+{
+	int i;
+
+	for (i = 0; i < pool->max_threads; i++)
+		___mutex_destroy(&pool->queues[i].lock);
+	___mutex_destroy(&pool->done_lock);
+	___mutex_destroy(&pool->lock);
+	free(pool->queue_node);
+	free(pool->cpu_node);
+	free(pool->cpus);
+	free(pool->queues);
+	free(pool->threads);
+	free(pool);
+}
+
+static void iv_work_event(void *_pool)
+{
+	struct work_pool_priv *pool = _pool;
+	struct iv_list_head items;
+
+	___mutex_lock(&pool->done_lock);
+	__iv_list_steal_elements(&pool->work_done, &items);
+	___mutex_unlock(&pool->done_lock);
+
+	while (!iv_list_empty(&items)) {
+		struct iv_work_item *work;
+
+		work = iv_container_of(items.next, struct iv_work_item, list);
+		iv_list_del(&work->list);
+
+		work->completion(work->cookie);
+	}
+
+	if (pool->shutting_down) {
+		int done;
+
+		___mutex_lock(&pool->lock);
+		___mutex_lock(&pool->done_lock);
+		done = !pool->started_threads && !pool->pending &&
+			iv_list_empty(&pool->work_done);
+		___mutex_unlock(&pool->done_lock);
+		___mutex_unlock(&pool->lock);
+
+		if (done) {
+			iv_event_unregister(&pool->ev);
+			iv_event_unregister(&pool->thread_needed);
+			if (pool->high_watermark)
+				iv_event_unregister(&pool->watermark);
+			iv_work_pool_free(pool);
+		}
+	}
+}
+
+static int iv_work_start_thread(struct work_pool_priv *pool);
+
+/*
+ * With a queue delay target, the pool only grows when the oldest
+ * queued work item has been waiting for longer than the target.  The
+ * thread owning the pool checks this whenever work is submitted while
+ * all pool threads are busy, and from then on by way of ->delay_timer
+ * for as long as that remains the case, so that the pool also grows
+ * when all threads are stuck on long-running work items and nothing
+ * is being dequeued at all.
+ *
+ * The queue locks nest inside the pool lock here, which is the only
+ * place where both are held at the same time.
+ */
+static int64_t iv_work_queue_age_usec(struct work_pool_priv *pool)
+{
+	struct timespec now;
+	int64_t age;
+	int i;
+
+	iv_time_get(&now);
+
+	age = 0;
+	for (i = 0; i < pool->max_threads; i++) {
+		struct work_pool_queue *q = &pool->queues[i];
+
+		if (!atomic_load_relaxed(&q->count))
+			continue;
+
+		___mutex_lock(&q->lock);
+		if (!iv_list_empty(&q->work_items)) {
+			struct iv_work_item *work;
+			int64_t delay;
+
+			work = iv_container_of(q->work_items.next,
+					       struct iv_work_item, list);
+			delay = 1000000LL *
+				(now.tv_sec - work->submitted.tv_sec) +
+				(now.tv_nsec - work->submitted.tv_nsec) / 1000;
+			if (delay > age)
+				age = delay;
+		}
+		___mutex_unlock(&q->lock);
+	}
+
+	return age;
+}
+
+static int iv_work_pool_have_idle(struct work_pool_priv *pool)
+{
+	struct iv_list_head *ilh;
+
+	iv_list_for_each (ilh, &pool->idle_threads) {
+		struct work_pool_thread *thr;
+
+		thr = iv_container_of(ilh, struct work_pool_thread, list);
+		if (!thr->kicked)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void iv_work_check_delay(struct work_pool_priv *pool)
+{
+	int64_t wait;
+
+	if (iv_timer_registered(&pool->delay_timer))
+		iv_timer_unregister(&pool->delay_timer);
+
+	if (pool->shutting_down || !atomic_load_relaxed(&pool->pending) ||
+	    iv_work_pool_have_idle(pool) ||
+	    pool->started_threads >= pool->max_threads) {
+		return;
+	}
+
+	wait = pool->max_queue_delay_usec - iv_work_queue_age_usec(pool);
+	if (wait < 0) {
+		if (iv_work_start_thread(pool) < 0)
+			return;
+		wait = pool->max_queue_delay_usec;
+	}
+
+	iv_validate_now();
+	pool->delay_timer.expires = iv_now;
+	pool->delay_timer.expires.tv_sec += wait / 1000000;
+	pool->delay_timer.expires.tv_nsec += 1000 * (wait % 1000000);
+	if (pool->delay_timer.expires.tv_nsec >= 1000000000L) {
+		pool->delay_timer.expires.tv_sec++;
+		pool->delay_timer.expires.tv_nsec -= 1000000000L;
+	}
+	iv_timer_register(&pool->delay_timer);
+}
+
+static void iv_work_delay_timer_expired(void *_pool)
+{
+	struct work_pool_priv *pool = _pool;
+
+	___mutex_lock(&pool->lock);
+	iv_work_check_delay(pool);
+	___mutex_unlock(&pool->lock);
+}
+
+static void iv_work_thread_needed(void *_pool)
+{
+	struct work_pool_priv *pool = _pool;
+
+	___mutex_lock(&pool->lock);
+
+	if (pool->max_queue_delay_usec && pool->started_threads) {
+		iv_work_check_delay(pool);
+	} else if (iv_list_empty(&pool->idle_threads) &&
+		   pool->started_threads < pool->max_threads) {
+		iv_work_start_thread(pool);
+	}
+
+	___mutex_unlock(&pool->lock);
+}
+
+static void iv_work_watermark(void *_pool)
+{
+	struct work_pool_priv *pool = _pool;
+	int pending;
+
+	if (pool->shutting_down)
+		return;
+
+	pending = atomic_load_relaxed(&pool->pending);
+
+	if (!pool->above_watermark && pending >= pool->high_watermark) {
+		pool->above_watermark = 1;
+		if (pool->queue_full != NULL)
+			pool->queue_full(pool->cookie);
+	} else if (pool->above_watermark && pending <= pool->low_watermark) {
+		pool->above_watermark = 0;
+		if (pool->queue_drained != NULL)
+			pool->queue_drained(pool->cookie);
+	}
+}
+
+static void
+iv_work_watermark_crossed(struct work_pool_priv *pool, int from_owner_thread)
+{
+	if (from_owner_thread)
+		iv_work_watermark(pool);
+	else
+		iv_event_post(&pool->watermark);
+}
+
+int iv_work_pool_create(struct iv_work_pool *this)
+{
+	struct work_pool_priv *pool;
+	int i;
+
+	if (this->max_threads <= 0 || this->min_threads < 0 ||
+	    this->min_threads > this->max_threads) {
+		return -1;
+	}
+
+	if (this->high_watermark < 0 || (this->high_watermark &&
+	    (this->low_watermark < 0 ||
+	     this->low_watermark >= this->high_watermark))) {
+		return -1;
+	}
+
+	if ((this->flags & IV_WORK_POOL_FLAG_HARD_LIMIT) &&
+	    !this->high_watermark) {
+		return -1;
+	}
+
+	pool = malloc(sizeof(*pool));
+	if (pool == NULL)
+		return -1;
+
+	pool->max_threads = this->max_threads;
+	pool->cpus = NULL;
+	pool->num_cpus = 0;
+	pool->cpu_node = NULL;
+	pool->num_cpu_node = 0;
+	pool->queue_node = NULL;
+
+	pool->threads = calloc(this->max_threads, sizeof(*pool->threads));
+	pool->queues = malloc(this->max_threads * sizeof(*pool->queues));
+	if (pool->threads == NULL || pool->queues == NULL)
+		goto out;
+
+	if (iv_work_pool_init_affinity(pool, this) < 0)
+		goto out;
+
+	if (___mutex_init(&pool->lock))
+		goto out;
+
+	___mutex_init(&pool->done_lock);
+	for (i = 0; i < this->max_threads; i++) {
+		___mutex_init(&pool->queues[i].lock);
+		INIT_IV_LIST_HEAD(&pool->queues[i].work_items);
+		pool->queues[i].count = 0;
+		pool->queues[i].head_priority = 0;
+	}
+
+	IV_EVENT_INIT(&pool->ev);
+	pool->ev.cookie = pool;
+	pool->ev.handler = iv_work_event;
+	iv_event_register(&pool->ev);
+
+	IV_EVENT_INIT(&pool->thread_needed);
+	pool->thread_needed.cookie = pool;
+	pool->thread_needed.handler = iv_work_thread_needed;
+	iv_event_register(&pool->thread_needed);
+
+	pool->high_watermark = this->high_watermark;
+	pool->low_watermark = this->low_watermark;
+	pool->hard_limit = !!(this->flags & IV_WORK_POOL_FLAG_HARD_LIMIT);
+	pool->queue_full = this->queue_full;
+	pool->queue_drained = this->queue_drained;
+	pool->above_watermark = 0;
+	IV_EVENT_INIT(&pool->watermark);
+	pool->watermark.cookie = pool;
+	pool->watermark.handler = iv_work_watermark;
+	if (pool->high_watermark)
+		iv_event_register(&pool->watermark);
+
+	pool->min_threads = this->min_threads;
+	pool->idle_timeout_msec = this->idle_timeout_msec;
+	if (pool->idle_timeout_msec <= 0)
+		pool->idle_timeout_msec = 10000;
+	pool->max_queue_delay_usec = this->max_queue_delay_usec;
+	IV_TIMER_INIT(&pool->delay_timer);
+	pool->delay_timer.cookie = pool;
+	pool->delay_timer.handler = iv_work_delay_timer_expired;
+	pool->shutting_down = 0;
+	pool->started_threads = 0;
+	INIT_IV_LIST_HEAD(&pool->idle_threads);
+	pool->cookie = this->cookie;
+	pool->thread_start = this->thread_start;
+	pool->thread_stop = this->thread_stop;
+#ifndef _WIN32
+	pool->lightweight = !!(this->flags & IV_WORK_POOL_FLAG_LIGHTWEIGHT);
+#else
+	pool->lightweight = 0;
+#endif
+	pool->pending = 0;
+	pool->prio_pending = 0;
+	pool->next_queue = 0;
+	INIT_IV_LIST_HEAD(&pool->work_done);
+
+	pool->tid = iv_get_thread_id();
+
+	this->priv = pool;
+
+	/*
+	 * Pre-spawn the minimum number of threads, so that the first
+	 * burst of work doesn't have to wait for thread creation.
+	 */
+	___mutex_lock(&pool->lock);
+	for (i = 0; i < pool->min_threads; i++)
+		iv_work_start_thread(pool);
+	___mutex_unlock(&pool->lock);
+
+	return 0;
+
+out:
+	free(pool->queue_node);
+	free(pool->cpu_node);
+	free(pool->cpus);
+	free(pool->threads);
+	free(pool->queues);
+	free(pool);
+
+	return -1;
+}
+
+void iv_work_pool_put(struct iv_work_pool *this)
+{
+	struct work_pool_priv *pool = this->priv;
+	struct iv_list_head *ilh;
+
+	___mutex_lock(&pool->lock);
+
+	this->priv = NULL;
+	pool->shutting_down = 1;
+
+	if (iv_timer_registered(&pool->delay_timer))
+		iv_timer_unregister(&pool->delay_timer);
+
+	if (!pool->started_threads) {
+		___mutex_unlock(&pool->lock);
+		iv_event_post(&pool->ev);
+		return;
+	}
+
+	iv_list_for_each (ilh, &pool->idle_threads) {
+		struct work_pool_thread *thr;
+
+		thr = iv_container_of(ilh, struct work_pool_thread, list);
+		iv_work_thread_kick(thr);
+	}
+
+	___mutex_unlock(&pool->lock);
+}
+
+static int iv_work_start_thread(struct work_pool_priv *pool)
+{
+	struct work_pool_thread *thr;
+	char name[512];
+	int index;
+	int ret;
+
+	for (index = 0; index < pool->max_threads; index++) {
+		if (pool->threads[index] == NULL)
+			break;
+	}
+
+	if (index == pool->max_threads)
+		return -1;
+
+	thr = malloc(sizeof(*thr));
+	if (thr == NULL)
+		return -1;
+
+	thr->pool = pool;
+	thr->index = index;
+	INIT_IV_LIST_HEAD(&thr->list);
+	thr->kicked = 0;
+
+	snprintf(name, sizeof(name), "iv_work pool %p thread %p", pool, thr);
+
+#ifndef _WIN32
+	if (pool->lightweight) {
+		if (pthr_cond_init(&thr->cond, NULL)) {
+			free(thr);
+			return -1;
+		}
+
+		ret = iv_thread_create(name, iv_work_thread_lightweight, thr);
+		if (ret < 0) {
+			pthr_cond_destroy(&thr->cond);
+			free(thr);
+			return -1;
+		}
+
+		pool->threads[index] = thr;
+		pool->started_threads++;
+
+		return 0;
+	}
+#endif
+
+	ret = iv_thread_create(name, iv_work_thread, thr);
+	if (ret < 0) {
+		free(thr);
+		return -1;
+	}
+
+	pool->threads[index] = thr;
+	pool->started_threads++;
+
+	return 0;
+}
+
+/*
+ * Make sure that up to @num newly queued work items will be picked
+ * up, by kicking up to @num idle threads (counting threads that have
+ * already been kicked but haven't run yet), and starting new threads
+ * for the rest, if allowed.  Called with the pool lock held.
+ */
+static void iv_work_pool_wake(struct work_pool_priv *pool, int num,
+			      int called_from_owner_thread, int prefer)
+{
+	struct iv_list_head *ilh;
+
+	if (prefer >= 0 && pool->threads[prefer] != NULL) {
+		struct work_pool_thread *thr = pool->threads[prefer];
+
+		if (!iv_list_empty(&thr->list) && !thr->kicked) {
+			thr->kicked = 1;
+			iv_work_thread_kick(thr);
+			num--;
+		}
+	}
+
+	iv_list_for_each (ilh, &pool->idle_threads) {
+		struct work_pool_thread *thr;
+
+		if (!num)
+			return;
+
+		thr = iv_container_of(ilh, struct work_pool_thread, list);
+		if (!thr->kicked) {
+			thr->kicked = 1;
+			iv_work_thread_kick(thr);
+		}
+
+		num--;
+	}
+
+	/*
+	 * With a queue delay target, leave it to the thread owning the
+	 * pool to decide when to grow the pool.
+	 */
+	if (pool->max_queue_delay_usec && pool->started_threads) {
+		if (called_from_owner_thread)
+			iv_work_check_delay(pool);
+		else
+			iv_event_post(&pool->thread_needed);
+		return;
+	}
+
+	while (num && pool->started_threads < pool->max_threads) {
+		if (!called_from_owner_thread) {
+			iv_event_post(&pool->thread_needed);
+			break;
+		}
+
+		if (iv_work_start_thread(pool) < 0)
+			break;
+
+		num--;
+	}
+}
+
+static struct work_sink *iv_work_thread_sink(void);
+
+/*
+ * Decide where the completion callback of @work will be run: in the
+ * worker thread, in an explicitly given loop, in the submitting
+ * thread if that isn't the thread owning the pool, or else in the
+ * thread owning the pool.
+ */
+static void iv_work_set_sink(struct iv_work_item *work, int foreign)
+{
+	struct work_sink *sink;
+
+	work->completion_sink = NULL;
+	work->queue = NULL;
+
+	if (work->flags & IV_WORK_ITEM_FLAG_INLINE_COMPLETION)
+		return;
+
+	if (work->completion_loop != NULL) {
+		work->completion_sink = work->completion_loop->priv;
+		return;
+	}
+
+	if (!foreign)
+		return;
+
+	sink = iv_work_thread_sink();
+	if (!sink->registered) {
+		iv_event_register(&sink->ev);
+		sink->registered = 1;
+	}
+	sink->outstanding++;
+
+	work->completion_sink = sink;
+}
+
+/*
+ * Work items submitted by the user directly are subject to the hard
+ * limit (if enabled), but continuations and strand runners are not,
+ * as there is no way for a worker thread or a strand to handle having
+ * their submission refused.
+ */
+static int __iv_work_submit_pool(struct work_pool_priv *pool,
+				 struct iv_work_item *work, int continuation,
+				 int limited)
+{
+	int called_from_owner_thread = (pool->tid == iv_get_thread_id());
+	int crossed;
+	int index;
+
+	if (!continuation && !called_from_owner_thread && !iv_inited()) {
+		iv_fatal("iv_work_submit_pool: work items can only be "
+			 "submitted from ivykis threads");
+	}
+
+	if (limited) {
+		if (work_pool_pending_reserve(pool, 1, &crossed) < 0) {
+			if (crossed) {
+				iv_work_watermark_crossed(pool,
+						called_from_owner_thread);
+			}
+			errno = EAGAIN;
+			return -1;
+		}
+	} else {
+		crossed = work_pool_pending_add(pool, 1);
+	}
+
+	iv_work_set_sink(work, !continuation && !called_from_owner_thread);
+	iv_work_stamp_item(pool, work);
+	index = work_pool_queue_add(pool, work);
+
+	___mutex_lock(&pool->lock);
+	iv_work_pool_wake(pool, 1, called_from_owner_thread,
+			  pool->queue_node != NULL ? index : -1);
+	___mutex_unlock(&pool->lock);
+
+	if (crossed)
+		iv_work_watermark_crossed(pool, called_from_owner_thread);
+
+	return 0;
+}
+
+static int iv_work_submit_pool(struct iv_work_pool *this,
+			       struct iv_work_item *work, int continuation)
+{
+	return __iv_work_submit_pool(this->priv, work, continuation,
+				     !continuation);
+}
+
+static int iv_work_submit_pool_batch(struct iv_work_pool *this,
+				     struct iv_work_item **work, int num)
+{
+	struct work_pool_priv *pool = this->priv;
+	int called_from_owner_thread = (pool->tid == iv_get_thread_id());
+	unsigned int start;
+	int crossed;
+	int i;
+
+	if (!called_from_owner_thread && !iv_inited()) {
+		iv_fatal("iv_work_submit_pool_batch: work items can only be "
+			 "submitted from ivykis threads");
+	}
+
+	if (num <= 0)
+		return 0;
+
+	/*
+	 * A batch is refused as a whole if it doesn't fit under the
+	 * hard limit.
+	 */
+	if (work_pool_pending_reserve(pool, num, &crossed) < 0) {
+		if (crossed)
+			iv_work_watermark_crossed(pool,
+						  called_from_owner_thread);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	/*
+	 * Spread the batch round-robin over the queues like individual
+	 * submissions would, but take each queue lock only once.
+	 */
+	for (i = 0; i < num; i++) {
+		iv_work_set_sink(work[i], !called_from_owner_thread);
+		iv_work_stamp_item(pool, work[i]);
+		if (work[i]->priority)
+			atomic_fetch_add(&pool->prio_pending, 1);
+	}
+	start = atomic_fetch_add(&pool->next_queue, num);
+
+	for (i = 0; i < num && i < pool->max_threads; i++) {
+		struct work_pool_queue *q;
+		int j;
+
+		q = &pool->queues[(start + i) % pool->max_threads];
+
+		___mutex_lock(&q->lock);
+		for (j = i; j < num; j += pool->max_threads)
+			work_pool_queue_insert(q, work[j]);
+		___mutex_unlock(&q->lock);
+	}
+
+	___mutex_lock(&pool->lock);
+	iv_work_pool_wake(pool, num, called_from_owner_thread, -1);
+	___mutex_unlock(&pool->lock);
+
+	if (crossed)
+		iv_work_watermark_crossed(pool, called_from_owner_thread);
+
+	return 0;
+}
+
+struct iv_work_thr_info {
+	struct iv_task		task;
+	struct iv_list_head	work_items;
+	struct work_sink	sink;
+};
+
+static void iv_work_handle_local(void *_tinfo);
+
+static void iv_work_tls_init_thread(void *_tinfo)
+{
+	struct iv_work_thr_info *tinfo = _tinfo;
+
+	IV_TASK_INIT(&tinfo->task);
+	tinfo->task.cookie = tinfo;
+	tinfo->task.handler = iv_work_handle_local;
+
+	INIT_IV_LIST_HEAD(&tinfo->work_items);
+
+	if (iv_work_sink_init(&tinfo->sink))
+		iv_fatal("iv_work_tls_init_thread: can't initialise mutex");
+}
+
+static void iv_work_tls_deinit_thread(void *_tinfo)
+{
+	struct iv_work_thr_info *tinfo = _tinfo;
+
+	___mutex_destroy(&tinfo->sink.lock);
+}
+
+static struct iv_tls_user iv_work_tls_user = {
+	.sizeof_state	= sizeof(struct iv_work_thr_info),
+	.init_thread	= iv_work_tls_init_thread,
+	.deinit_thread	= iv_work_tls_deinit_thread,
+};
 
 static void iv_work_tls_init(void) __attribute__((constructor));
 static void iv_work_tls_init(void)
@@ -397,6 +1700,13 @@ static void iv_work_tls_init(void)
 	iv_tls_user_register(&iv_work_tls_user);
 }
 
+static struct work_sink *iv_work_thread_sink(void)
+{
+	struct iv_work_thr_info *tinfo = iv_tls_user_ptr(&iv_work_tls_user);
+
+	return &tinfo->sink;
+}
+
 static void iv_work_handle_local(void *_tinfo)
 {
 	struct iv_work_thr_info *tinfo = _tinfo;
@@ -408,8 +1718,18 @@ static void iv_work_handle_local(void *_tinfo)
 
 		work = iv_container_of(items.next, struct iv_work_item, list);
 		iv_list_del(&work->list);
+		work->queue = NULL;
+
+		work->timed_out = iv_work_item_expired(work);
+		if (!work->timed_out)
+			work->work(work->cookie);
+
+		if (work->completion_loop != NULL &&
+		    !(work->flags & IV_WORK_ITEM_FLAG_INLINE_COMPLETION)) {
+			iv_work_sink_add(work->completion_loop->priv, work);
+			continue;
+		}
 
-		work->work(work->cookie);
 		work->completion(work->cookie);
 	}
 }
@@ -422,15 +1742,32 @@ static void iv_work_submit_local(struct iv_work_item *work)
 		iv_task_register(&tinfo->task);
 
 	iv_list_add_tail(&work->list, &tinfo->work_items);
+	work->queue = tinfo;
 }
 
-void
+int
 iv_work_pool_submit_work(struct iv_work_pool *this, struct iv_work_item *work)
 {
 	if (this != NULL)
-		iv_work_submit_pool(this, work, 0);
-	else
-		iv_work_submit_local(work);
+		return iv_work_submit_pool(this, work, 0);
+
+	iv_work_submit_local(work);
+
+	return 0;
+}
+
+int iv_work_pool_submit_batch(struct iv_work_pool *this,
+			      struct iv_work_item **work, int num)
+{
+	int i;
+
+	if (this != NULL)
+		return iv_work_submit_pool_batch(this, work, num);
+
+	for (i = 0; i < num; i++)
+		iv_work_submit_local(work[i]);
+
+	return 0;
 }
 
 void iv_work_pool_submit_continuation(struct iv_work_pool *this,
@@ -441,3 +1778,366 @@ void iv_work_pool_submit_continuation(struct iv_work_pool *this,
 	else
 		iv_work_submit_local(work);
 }
+
+/* cancellation *************************************************************/
+/*
+ * ->queue points to the per-thread queue that a work item is sitting
+ * in (or to the thread's local work list for work items submitted to
+ * a NULL pool), and is cleared under the queue lock when a worker
+ * thread dequeues the item.  Work items are never moved from one
+ * queue to another, so if ->queue is still the same after taking the
+ * queue lock, the item hasn't started yet and can be unlinked.
+ */
+static void iv_work_sink_forget(struct iv_work_item *work)
+{
+	struct work_sink *sink = work->completion_sink;
+
+	if (sink == NULL || sink->registered == 2)
+		return;
+
+	if (sink != iv_work_thread_sink()) {
+		iv_fatal("iv_work_item_cancel: called from a thread other "
+			 "than the submitting thread");
+	}
+
+	if (sink->outstanding)
+		sink->outstanding--;
+
+	if (sink->registered == 1 && !sink->outstanding) {
+		iv_event_unregister(&sink->ev);
+		sink->registered = 0;
+	}
+}
+
+static int iv_work_cancel_local(struct iv_work_item *work)
+{
+	struct iv_work_thr_info *tinfo = iv_tls_user_ptr(&iv_work_tls_user);
+
+	if (work->queue != tinfo)
+		return -1;
+
+	iv_list_del(&work->list);
+	work->queue = NULL;
+
+	if (iv_list_empty(&tinfo->work_items) &&
+	    iv_task_registered(&tinfo->task)) {
+		iv_task_unregister(&tinfo->task);
+	}
+
+	return 0;
+}
+
+int iv_work_item_cancel(struct iv_work_pool *this, struct iv_work_item *work)
+{
+	struct work_pool_priv *pool;
+	struct work_pool_queue *q;
+
+	if (this == NULL)
+		return iv_work_cancel_local(work);
+
+	pool = this->priv;
+
+	q = atomic_load_relaxed(&work->queue);
+	if (q == NULL)
+		return -1;
+
+	___mutex_lock(&q->lock);
+	if (work->queue != q) {
+		___mutex_unlock(&q->lock);
+		return -1;
+	}
+	work_pool_queue_unlink(q, work);
+	___mutex_unlock(&q->lock);
+
+	if (work_pool_pending_add(pool, -1)) {
+		iv_work_watermark_crossed(pool,
+				pool->tid == iv_get_thread_id());
+	}
+	if (work->priority)
+		atomic_fetch_add(&pool->prio_pending, -1);
+
+	iv_work_sink_forget(work);
+
+	return 0;
+}
+
+
+/* strands ******************************************************************/
+struct work_strand_priv {
+	struct work_pool_priv	*pool;
+	___mutex_t		lock;
+	struct iv_list_head	work_items;
+	struct iv_work_item	runner;
+	int			running;
+	int			dead;
+};
+
+/*
+ * A strand has at most one runner work item queued to (or running
+ * on) its pool at any given time, and the runner executes the work
+ * items that were submitted to the strand in order, which is what
+ * serialises them.  ->running and ->dead are only accessed from the
+ * thread owning the pool, and ->work_items is protected by ->lock.
+ */
+static void iv_work_strand_run(void *_strand)
+{
+	struct work_strand_priv *strand = _strand;
+
+	while (1) {
+		struct iv_work_item *work;
+
+		___mutex_lock(&strand->lock);
+		if (iv_list_empty(&strand->work_items)) {
+			___mutex_unlock(&strand->lock);
+			break;
+		}
+		work = iv_container_of(strand->work_items.next,
+				       struct iv_work_item, list);
+		iv_list_del(&work->list);
+		___mutex_unlock(&strand->lock);
+
+		iv_work_run_item(strand->pool, work);
+	}
+}
+
+static void iv_work_strand_free(struct work_strand_priv *strand)
+{
+	___mutex_destroy(&strand->lock);
+	free(strand);
+}
+
+static void iv_work_strand_run_done(void *_strand)
+{
+	struct work_strand_priv *strand = _strand;
+	int empty;
+
+	___mutex_lock(&strand->lock);
+	empty = iv_list_empty(&strand->work_items);
+	___mutex_unlock(&strand->lock);
+
+	/*
+	 * Work items that were submitted after the runner checked the
+	 * strand queue for the last time need another runner pass.
+	 */
+	if (!empty) {
+		__iv_work_submit_pool(strand->pool, &strand->runner, 0, 0);
+		return;
+	}
+
+	strand->running = 0;
+	if (strand->dead)
+		iv_work_strand_free(strand);
+}
+
+int iv_work_strand_create(struct iv_work_strand *this)
+{
+	struct work_strand_priv *strand;
+
+	if (this->pool == NULL) {
+		this->priv = NULL;
+		return 0;
+	}
+
+	strand = malloc(sizeof(*strand));
+	if (strand == NULL)
+		return -1;
+
+	if (___mutex_init(&strand->lock)) {
+		free(strand);
+		return -1;
+	}
+
+	strand->pool = this->pool->priv;
+	INIT_IV_LIST_HEAD(&strand->work_items);
+	IV_WORK_ITEM_INIT(&strand->runner);
+	strand->runner.cookie = strand;
+	strand->runner.work = iv_work_strand_run;
+	strand->runner.completion = iv_work_strand_run_done;
+	strand->running = 0;
+	strand->dead = 0;
+
+	this->priv = strand;
+
+	return 0;
+}
+
+void iv_work_strand_put(struct iv_work_strand *this)
+{
+	struct work_strand_priv *strand = this->priv;
+
+	this->priv = NULL;
+
+	if (strand == NULL)
+		return;
+
+	strand->dead = 1;
+	if (!strand->running)
+		iv_work_strand_free(strand);
+}
+
+void iv_work_strand_submit(struct iv_work_strand *this,
+			   struct iv_work_item *work)
+{
+	struct work_strand_priv *strand = this->priv;
+
+	if (strand == NULL) {
+		iv_work_submit_local(work);
+		return;
+	}
+
+	iv_work_set_sink(work, 0);
+
+	___mutex_lock(&strand->lock);
+	iv_list_add_tail(&work->list, &strand->work_items);
+	___mutex_unlock(&strand->lock);
+
+	if (!strand->running) {
+		strand->running = 1;
+		__iv_work_submit_pool(strand->pool, &strand->runner, 0, 0);
+	}
+}
+
+
+/* parallel for *************************************************************/
+struct work_parallel_priv {
+	int			count;
+	int			min_chunk;
+	void			*cookie;
+	void			(*work)(void *cookie, int start, int end);
+	void			(*completion)(void *cookie);
+	int			next;
+	int			num_runners;
+	int			outstanding;
+	struct iv_work_item	runners[0];
+};
+
+/*
+ * An index range is split over (at most) one runner work item per
+ * pool thread, and each runner repeatedly claims the next chunk of
+ * the range until it is exhausted.  Chunks are sized by guided
+ * self-scheduling: each claim takes a share of the indices that are
+ * left proportional to 1 / (2 * number of runners), but no fewer than
+ * ->min_chunk, so that chunks start out large (few atomic operations
+ * on ->next) and shrink towards the end of the range (so that the
+ * runners finish at roughly the same time even if the per-index cost
+ * varies).
+ *
+ * Runner completions all end up in the submitting thread, so
+ * ->outstanding doesn't need to be modified atomically.
+ */
+static int iv_work_parallel_claim(struct work_parallel_priv *par, int *start)
+{
+	int next;
+	int chunk;
+
+	next = atomic_load_relaxed(&par->next);
+	do {
+		int left = par->count - next;
+
+		if (left <= 0)
+			return 0;
+
+		chunk = left / (2 * par->num_runners);
+		if (chunk < par->min_chunk)
+			chunk = par->min_chunk;
+		if (chunk > left)
+			chunk = left;
+	} while (!atomic_cmpxchg(&par->next, &next, next + chunk));
+
+	*start = next;
+
+	return chunk;
+}
+
+static void iv_work_parallel_run(void *_par)
+{
+	struct work_parallel_priv *par = _par;
+	int start;
+	int chunk;
+
+	while ((chunk = iv_work_parallel_claim(par, &start)) != 0)
+		par->work(par->cookie, start, start + chunk);
+}
+
+static void iv_work_parallel_done(void *_par)
+{
+	struct work_parallel_priv *par = _par;
+	void (*completion)(void *cookie);
+	void *cookie;
+
+	if (--par->outstanding)
+		return;
+
+	completion = par->completion;
+	cookie = par->cookie;
+	free(par);
+
+	completion(cookie);
+}
+
+int iv_work_pool_submit_parallel(struct iv_work_pool *this,
+				 struct iv_work_parallel *par)
+{
+	struct work_parallel_priv *wp;
+	struct iv_work_item **batch;
+	int min_chunk;
+	int num;
+	int i;
+
+	if (par->count < 0)
+		return -1;
+
+	min_chunk = (par->min_chunk > 0) ? par->min_chunk : 1;
+
+	num = 1;
+	if (this != NULL) {
+		struct work_pool_priv *pool = this->priv;
+		int chunks;
+
+		chunks = par->count / min_chunk + !!(par->count % min_chunk);
+
+		num = pool->max_threads;
+		if (num > chunks)
+			num = chunks;
+		if (num < 1)
+			num = 1;
+	}
+
+	wp = malloc(sizeof(*wp) + num * sizeof(struct iv_work_item));
+	batch = malloc(num * sizeof(*batch));
+	if (wp == NULL || batch == NULL) {
+		free(batch);
+		free(wp);
+		return -1;
+	}
+
+	wp->count = par->count;
+	wp->min_chunk = min_chunk;
+	wp->cookie = par->cookie;
+	wp->work = par->work;
+	wp->completion = par->completion;
+	wp->next = 0;
+	wp->num_runners = num;
+	wp->outstanding = num;
+
+	for (i = 0; i < num; i++) {
+		struct iv_work_item *work = &wp->runners[i];
+
+		IV_WORK_ITEM_INIT(work);
+		work->cookie = wp;
+		work->work = iv_work_parallel_run;
+		work->completion = iv_work_parallel_done;
+
+		batch[i] = work;
+	}
+
+	if (iv_work_pool_submit_batch(this, batch, num) < 0) {
+		free(batch);
+		free(wp);
+		return -1;
+	}
+
+	free(batch);
+
+	return 0;
+}
@@ -46,6 +46,10 @@ static inline int pthreads_available(void)
 #pragma weak pthread_atfork
 #endif
 
+#pragma weak pthread_cond_destroy
+#pragma weak pthread_cond_init
+#pragma weak pthread_cond_signal
+#pragma weak pthread_cond_timedwait
 #pragma weak pthread_create
 #pragma weak pthread_detach
 #pragma weak pthread_getspecific
@@ -78,6 +82,44 @@ pthr_atfork(void (*prepare)(void), void (*parent)(void), void (*child)(void))
 	return ENOSYS;
 }
 
+static inline int pthr_cond_destroy(pthread_cond_t *cond)
+{
+	if (pthreads_available())
+		return pthread_cond_destroy(cond);
+
+	return 0;
+}
+
+static inline int
+pthr_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr)
+{
+	if (pthreads_available())
+		return pthread_cond_init(cond, attr);
+
+	return ENOSYS;
+}
+
+static inline int pthr_cond_signal(pthread_cond_t *cond)
+{
+	if (pthreads_available())
+		return pthread_cond_signal(cond);
+
+	return 0;
+}
+
+static inline int pthr_cond_timedwait(pthread_cond_t *cond,
+				      pthread_mutex_t *mutex,
+				      const struct timespec *abstime)
+{
+	if (pthreads_available())
+		return pthread_cond_timedwait(cond, mutex, abstime);
+
+	iv_fatal("pthr_cond_timedwait: called while pthreads isn't "
+		 "available");
+
+	return ENOSYS;
+}
+
 static inline int pthr_create(pthread_t *thread, const pthread_attr_t *attr,
 			      void *(*start_routine)(void *), void *arg)
 {
@@ -0,0 +1,126 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <iv.h>
+#include <iv_channel.h>
+#include <iv_event.h>
+#include <iv_thread.h>
+
+#define NUM_PRODUCERS	4
+#define NUM_MSGS	100000
+
+static struct iv_channel ch;
+static struct iv_event producer_done[NUM_PRODUCERS];
+static uint32_t next_seq[NUM_PRODUCERS];
+static int msgs_received;
+static int batches_received;
+static int producers_done;
+
+/*
+ * A producer can still be inside iv_channel_send() for its last
+ * message when that message is delivered, so the channel can only
+ * be unregistered once all producers have said that they're done
+ * and all messages have been received.
+ */
+static void check_done(void)
+{
+	if (msgs_received == NUM_PRODUCERS * NUM_MSGS &&
+	    producers_done == NUM_PRODUCERS) {
+		iv_channel_unregister(&ch);
+	}
+}
+
+static void got_producer_done(void *_ev)
+{
+	iv_event_unregister(_ev);
+	producers_done++;
+	check_done();
+}
+
+static void got_msgs(void *cookie, void **msgs, int num)
+{
+	int i;
+
+	batches_received++;
+
+	for (i = 0; i < num; i++) {
+		uintptr_t msg = (uintptr_t)msgs[i];
+		int producer = msg >> 24;
+		uint32_t seq = msg & 0xffffff;
+
+		if (seq != next_seq[producer]) {
+			iv_fatal("iv_channel_test: producer %d sent %d, "
+				 "expected %d", producer, (int)seq,
+				 (int)next_seq[producer]);
+		}
+		next_seq[producer]++;
+	}
+
+	msgs_received += num;
+	check_done();
+}
+
+static void producer(void *_id)
+{
+	uintptr_t id = (uintptr_t)_id;
+	uint32_t seq;
+
+	for (seq = 0; seq < NUM_MSGS; seq++) {
+		void *msg = (void *)((id << 24) | seq);
+
+		while (iv_channel_send(&ch, msg) < 0)
+			;
+	}
+
+	iv_event_post(&producer_done[id]);
+}
+
+int main()
+{
+	uintptr_t i;
+
+	iv_init();
+
+	IV_CHANNEL_INIT(&ch);
+	ch.max_msgs = 1024;
+	ch.handler = got_msgs;
+	iv_channel_register(&ch);
+
+	for (i = 0; i < NUM_PRODUCERS; i++) {
+		IV_EVENT_INIT(&producer_done[i]);
+		producer_done[i].cookie = &producer_done[i];
+		producer_done[i].handler = got_producer_done;
+		iv_event_register(&producer_done[i]);
+
+		iv_thread_create("producer", producer, (void *)i);
+	}
+
+	iv_main();
+
+	iv_deinit();
+
+	printf("%d messages received in %d batches\n",
+	       msgs_received, batches_received);
+
+	return 0;
+}
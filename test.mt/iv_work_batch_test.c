@@ -0,0 +1,121 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iv.h>
+#include <iv_work.h>
+
+#define NUM_THREADS	4
+#define NUM_ITEMS	64
+
+struct job {
+	struct iv_work_item	item;
+	int			ran;
+	int			completed;
+};
+
+static struct iv_work_pool pool;
+static struct job pool_jobs[NUM_ITEMS];
+static struct job local_jobs[NUM_ITEMS];
+static int completed;
+
+static void work(void *_job)
+{
+	struct job *job = _job;
+
+	job->ran++;
+}
+
+static void check_jobs(struct job *jobs, const char *what)
+{
+	int i;
+
+	for (i = 0; i < NUM_ITEMS; i++) {
+		if (jobs[i].ran != 1 || jobs[i].completed != 1) {
+			iv_fatal("iv_work_batch_test: %s item %d ran %d "
+				 "times, completed %d times", what, i,
+				 jobs[i].ran, jobs[i].completed);
+		}
+	}
+}
+
+static void work_complete(void *_job)
+{
+	struct job *job = _job;
+
+	job->completed++;
+	if (++completed < 2 * NUM_ITEMS)
+		return;
+
+	check_jobs(pool_jobs, "pool");
+	check_jobs(local_jobs, "local");
+
+	iv_work_pool_put(&pool);
+}
+
+static void submit_batch(struct iv_work_pool *this, struct job *jobs)
+{
+	struct iv_work_item *batch[NUM_ITEMS];
+	int i;
+
+	for (i = 0; i < NUM_ITEMS; i++) {
+		IV_WORK_ITEM_INIT(&jobs[i].item);
+		jobs[i].item.cookie = &jobs[i];
+		jobs[i].item.work = work;
+		jobs[i].item.completion = work_complete;
+		jobs[i].ran = 0;
+		jobs[i].completed = 0;
+
+		batch[i] = &jobs[i].item;
+	}
+
+	iv_work_pool_submit_batch(this, batch, NUM_ITEMS);
+}
+
+int main()
+{
+	iv_init();
+
+	IV_WORK_POOL_INIT(&pool);
+	pool.max_threads = NUM_THREADS;
+	iv_work_pool_create(&pool);
+
+	/*
+	 * An empty batch is a no-op.
+	 */
+	iv_work_pool_submit_batch(&pool, NULL, 0);
+
+	/*
+	 * A batch that is larger than the number of pool threads, so
+	 * that several items end up on each thread's queue, and a
+	 * batch of items for the calling thread itself.
+	 */
+	submit_batch(&pool, pool_jobs);
+	submit_batch(NULL, local_jobs);
+
+	iv_main();
+
+	iv_deinit();
+
+	printf("%d work items completed\n", completed);
+
+	return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iv.h>
+#include <iv_event.h>
+#include <iv_work.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#define NUM_ITEMS	10
+
+struct job {
+	struct iv_work_item	item;
+	int			ran;
+	int			completed;
+};
+
+static struct iv_work_pool pool;
+static struct iv_event started;
+static struct job blocker;
+static struct job jobs[NUM_ITEMS];
+static struct job local[2];
+static int jobs_done;
+
+static void work(void *_job)
+{
+	struct job *job = _job;
+
+	job->ran = 1;
+
+	if (job == &blocker) {
+		iv_event_post(&started);
+#ifndef _WIN32
+		usleep(200000);
+#else
+		Sleep(200);
+#endif
+	}
+}
+
+static void work_complete(void *_job)
+{
+	struct job *job = _job;
+	int i;
+
+	job->completed = 1;
+
+	if (++jobs_done < NUM_ITEMS / 2 + 1)
+		return;
+
+	for (i = 0; i < NUM_ITEMS; i++) {
+		if ((i & 1) && (jobs[i].ran || jobs[i].completed))
+			iv_fatal("iv_work_cancel_test: canceled item %d ran", i);
+		if (!(i & 1) && !jobs[i].completed)
+			iv_fatal("iv_work_cancel_test: item %d didn't run", i);
+	}
+
+	iv_work_pool_put(&pool);
+}
+
+static void local_complete(void *_job)
+{
+	struct job *job = _job;
+
+	job->completed = 1;
+	if (local[1].ran || local[1].completed)
+		iv_fatal("iv_work_cancel_test: canceled local item ran");
+}
+
+static void init_job(struct job *job)
+{
+	IV_WORK_ITEM_INIT(&job->item);
+	job->item.cookie = job;
+	job->item.work = work;
+	job->item.completion = work_complete;
+	job->ran = 0;
+	job->completed = 0;
+}
+
+static void got_started(void *_dummy)
+{
+	int i;
+
+	iv_event_unregister(&started);
+
+	/*
+	 * The single pool thread is now busy running the blocker, so
+	 * everything submitted from here on sits in the queue until the
+	 * blocker finishes.
+	 */
+	for (i = 0; i < NUM_ITEMS; i++) {
+		init_job(&jobs[i]);
+		iv_work_pool_submit_work(&pool, &jobs[i].item);
+	}
+
+	for (i = 1; i < NUM_ITEMS; i += 2) {
+		if (iv_work_item_cancel(&pool, &jobs[i].item))
+			iv_fatal("iv_work_cancel_test: can't cancel item %d", i);
+		if (!iv_work_item_cancel(&pool, &jobs[i].item)) {
+			iv_fatal("iv_work_cancel_test: item %d canceled "
+				 "twice", i);
+		}
+	}
+
+	if (!iv_work_item_cancel(&pool, &blocker.item))
+		iv_fatal("iv_work_cancel_test: canceled running item");
+}
+
+int main()
+{
+	int i;
+
+	iv_init();
+
+	IV_WORK_POOL_INIT(&pool);
+	pool.max_threads = 1;
+	iv_work_pool_create(&pool);
+
+	IV_EVENT_INIT(&started);
+	started.handler = got_started;
+	iv_event_register(&started);
+
+	init_job(&blocker);
+	iv_work_pool_submit_work(&pool, &blocker.item);
+
+	for (i = 0; i < 2; i++) {
+		init_job(&local[i]);
+		local[i].item.completion = local_complete;
+		iv_work_pool_submit_work(NULL, &local[i].item);
+	}
+
+	if (iv_work_item_cancel(NULL, &local[1].item))
+		iv_fatal("iv_work_cancel_test: can't cancel local item");
+
+	iv_main();
+
+	iv_deinit();
+
+	if (!local[0].completed)
+		iv_fatal("iv_work_cancel_test: local item didn't run");
+
+	printf("%d work items completed\n", jobs_done);
+
+	return 0;
+}
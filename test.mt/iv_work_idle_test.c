@@ -0,0 +1,153 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iv.h>
+#include <iv_work.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MIN_THREADS	1
+#define MAX_THREADS	4
+#define IDLE_MSEC	100
+#define DELAY_USEC	20000
+#define ITEM_MSEC	300
+#define MAX_START_MSEC	200
+
+struct job {
+	struct iv_work_item	item;
+	struct timespec		started;
+};
+
+static struct iv_work_pool pool;
+static struct job jobs[MAX_THREADS];
+static struct timespec submitted;
+static struct iv_timer settle;
+static int live_threads;
+static int completed;
+
+static void thread_start(void *_dummy)
+{
+	__sync_fetch_and_add(&live_threads, 1);
+}
+
+static void thread_stop(void *_dummy)
+{
+	__sync_fetch_and_add(&live_threads, -1);
+}
+
+/*
+ * All work items take much longer than the queue delay target, so
+ * once the pool threads are busy, nothing is dequeued for a while,
+ * and the pool has to grow based on the age of the queued items
+ * alone for all items to get started in time.
+ */
+static void work(void *_job)
+{
+	struct job *job = _job;
+
+	clock_gettime(CLOCK_MONOTONIC, &job->started);
+	usleep(1000 * ITEM_MSEC);
+}
+
+static void got_settled(void *_dummy)
+{
+	int live;
+
+	live = __sync_fetch_and_add(&live_threads, 0);
+	if (live != MIN_THREADS) {
+		iv_fatal("iv_work_idle_test: %d threads left after idle "
+			 "timeout, expected %d", live, MIN_THREADS);
+	}
+
+	iv_work_pool_put(&pool);
+}
+
+static void work_complete(void *_job)
+{
+	int i;
+
+	if (++completed < MAX_THREADS)
+		return;
+
+	for (i = 0; i < MAX_THREADS; i++) {
+		long long delay;
+
+		delay = 1000LL * (jobs[i].started.tv_sec - submitted.tv_sec) +
+			(jobs[i].started.tv_nsec - submitted.tv_nsec) / 1000000;
+		if (delay > MAX_START_MSEC) {
+			iv_fatal("iv_work_idle_test: item %d started after "
+				 "%d ms", i, (int)delay);
+		}
+	}
+
+	/*
+	 * Give the extra threads ample time to time out.
+	 */
+	IV_TIMER_INIT(&settle);
+	iv_validate_now();
+	settle.expires = iv_now;
+	settle.expires.tv_sec++;
+	settle.handler = got_settled;
+	iv_timer_register(&settle);
+}
+
+int main()
+{
+	int i;
+
+	iv_init();
+
+	IV_WORK_POOL_INIT(&pool);
+	pool.max_threads = MAX_THREADS;
+	pool.min_threads = MIN_THREADS;
+	pool.idle_timeout_msec = IDLE_MSEC;
+	pool.max_queue_delay_usec = DELAY_USEC;
+	pool.thread_start = thread_start;
+	pool.thread_stop = thread_stop;
+#ifdef LIGHTWEIGHT
+	pool.flags = IV_WORK_POOL_FLAG_LIGHTWEIGHT;
+#endif
+	iv_work_pool_create(&pool);
+
+	clock_gettime(CLOCK_MONOTONIC, &submitted);
+	for (i = 0; i < MAX_THREADS; i++) {
+		IV_WORK_ITEM_INIT(&jobs[i].item);
+		jobs[i].item.cookie = &jobs[i];
+		jobs[i].item.work = work;
+		jobs[i].item.completion = work_complete;
+		iv_work_pool_submit_work(&pool, &jobs[i].item);
+	}
+
+	iv_main();
+
+	iv_deinit();
+
+	if (__sync_fetch_and_add(&live_threads, 0)) {
+		fprintf(stderr, "iv_work_idle_test: threads left after "
+				"pool shutdown\n");
+		return 1;
+	}
+
+	printf("%d work items completed\n", completed);
+
+	return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <iv.h>
+#include <iv_event.h>
+#include <iv_work.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#define HIGH_WATERMARK	8
+#define LOW_WATERMARK	2
+#define NUM_ITEMS	20
+
+static struct iv_work_pool pool;
+static struct iv_event started;
+static struct iv_work_item blocker;
+static struct iv_work_item items[NUM_ITEMS];
+static struct iv_work_item *batch[NUM_ITEMS];
+static int accepted;
+static int completed;
+static int full_calls;
+static int drained;
+
+static void work(void *_item)
+{
+	if (_item == &blocker) {
+		iv_event_post(&started);
+#ifndef _WIN32
+		usleep(200000);
+#else
+		Sleep(200);
+#endif
+	}
+}
+
+static void work_complete(void *_item);
+
+static void queue_full(void *cookie)
+{
+	full_calls++;
+}
+
+static void init_item(struct iv_work_item *item)
+{
+	IV_WORK_ITEM_INIT(item);
+	item->cookie = item;
+	item->work = work;
+	item->completion = work_complete;
+}
+
+static void work_complete(void *_item)
+{
+	int i;
+
+	if (++completed < accepted + 1)
+		return;
+
+	if (drained) {
+		iv_work_pool_put(&pool);
+		return;
+	}
+	drained = 1;
+
+	/*
+	 * The queue is empty again, so a batch that exactly fills it
+	 * should be accepted, and one more item should not.
+	 */
+	for (i = 0; i < HIGH_WATERMARK + 1; i++) {
+		init_item(&items[i]);
+		batch[i] = &items[i];
+	}
+
+	if (iv_work_pool_submit_batch(&pool, batch, HIGH_WATERMARK + 1) != -1)
+		iv_fatal("iv_work_limit_test: oversized batch accepted");
+
+	if (iv_work_pool_submit_batch(&pool, batch, HIGH_WATERMARK) < 0)
+		iv_fatal("iv_work_limit_test: batch refused");
+	accepted += HIGH_WATERMARK;
+}
+
+static void got_started(void *_dummy)
+{
+	int i;
+
+	iv_event_unregister(&started);
+
+	/*
+	 * The single pool thread is busy running the blocker, so the
+	 * queue fills up after exactly HIGH_WATERMARK submissions.
+	 */
+	for (i = 0; i < NUM_ITEMS; i++) {
+		init_item(&items[i]);
+
+		errno = 0;
+		if (iv_work_pool_submit_work(&pool, &items[i]) == 0) {
+			accepted++;
+			continue;
+		}
+
+		if (errno != EAGAIN) {
+			iv_fatal("iv_work_limit_test: submission failed "
+				 "with errno %d", errno);
+		}
+	}
+
+	if (accepted != HIGH_WATERMARK || full_calls != 1) {
+		iv_fatal("iv_work_limit_test: %d items accepted, queue_full "
+			 "called %d times", accepted, full_calls);
+	}
+}
+
+int main()
+{
+	iv_init();
+
+	IV_WORK_POOL_INIT(&pool);
+	pool.max_threads = 1;
+	pool.flags = IV_WORK_POOL_FLAG_HARD_LIMIT;
+	pool.high_watermark = HIGH_WATERMARK;
+	pool.low_watermark = LOW_WATERMARK;
+	pool.queue_full = queue_full;
+	iv_work_pool_create(&pool);
+
+	IV_EVENT_INIT(&started);
+	started.handler = got_started;
+	iv_event_register(&started);
+
+	init_item(&blocker);
+	iv_work_pool_submit_work(&pool, &blocker);
+
+	iv_main();
+
+	iv_deinit();
+
+	printf("%d work items completed\n", completed);
+
+	return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iv.h>
+#include <iv_event.h>
+#include <iv_thread.h>
+#include <iv_work.h>
+
+#define NUM_THREADS	2
+#define NUM_ITEMS	1000
+#define NUM_INLINE	100
+
+struct job {
+	struct iv_work_item	item;
+	unsigned long		tid;
+	int			*count;
+	struct iv_event		ev;
+};
+
+static struct iv_work_pool pool;
+static struct iv_work_loop main_loop;
+static unsigned long main_tid;
+static int main_count;
+static int inline_count;
+static struct job inline_jobs[NUM_INLINE];
+
+static void work(void *_job)
+{
+}
+
+static void check_done(void)
+{
+	if (main_count == NUM_THREADS * NUM_ITEMS / 2 &&
+	    inline_count == NUM_INLINE) {
+		iv_work_loop_unregister(&main_loop);
+		iv_work_pool_put(&pool);
+	}
+}
+
+static void work_complete_submitter(void *_job)
+{
+	struct job *job = _job;
+
+	if (iv_get_thread_id() != job->tid)
+		iv_fatal("iv_work_loop_test: completion in wrong thread");
+
+	(*job->count)++;
+}
+
+static void work_complete_main(void *_job)
+{
+	if (iv_get_thread_id() != main_tid)
+		iv_fatal("iv_work_loop_test: completion not in main thread");
+
+	main_count++;
+	check_done();
+}
+
+static void work_complete_inline(void *_job)
+{
+	struct job *job = _job;
+
+	if (iv_get_thread_id() == main_tid)
+		iv_fatal("iv_work_loop_test: inline completion in main thread");
+
+	iv_event_post(&job->ev);
+}
+
+static void got_inline_done(void *_job)
+{
+	struct job *job = _job;
+
+	iv_event_unregister(&job->ev);
+
+	inline_count++;
+	check_done();
+}
+
+static void submitter(void *_dummy)
+{
+	struct job *jobs;
+	int count;
+	int i;
+
+	iv_init();
+
+	jobs = malloc(NUM_ITEMS * sizeof(*jobs));
+	if (jobs == NULL)
+		iv_fatal("iv_work_loop_test: out of memory");
+
+	count = 0;
+	for (i = 0; i < NUM_ITEMS; i++) {
+		struct job *job = &jobs[i];
+
+		IV_WORK_ITEM_INIT(&job->item);
+		job->item.cookie = job;
+		job->item.work = work;
+		job->tid = iv_get_thread_id();
+		job->count = &count;
+
+		if (i & 1) {
+			job->item.completion = work_complete_main;
+			job->item.completion_loop = &main_loop;
+		} else {
+			job->item.completion = work_complete_submitter;
+		}
+
+		iv_work_pool_submit_work(&pool, &job->item);
+	}
+
+	/*
+	 * This returns once all completions for this thread have
+	 * been delivered to it.
+	 */
+	iv_main();
+
+	if (count != NUM_ITEMS / 2) {
+		iv_fatal("iv_work_loop_test: got %d completions, "
+			 "expected %d", count, NUM_ITEMS / 2);
+	}
+
+	free(jobs);
+
+	iv_deinit();
+}
+
+int main()
+{
+	int i;
+
+	iv_init();
+
+	main_tid = iv_get_thread_id();
+
+	IV_WORK_POOL_INIT(&pool);
+	pool.max_threads = 4;
+	iv_work_pool_create(&pool);
+
+	IV_WORK_LOOP_INIT(&main_loop);
+	iv_work_loop_register(&main_loop);
+
+	for (i = 0; i < NUM_INLINE; i++) {
+		struct job *job = &inline_jobs[i];
+
+		IV_WORK_ITEM_INIT(&job->item);
+		job->item.cookie = job;
+		job->item.work = work;
+		job->item.completion = work_complete_inline;
+		job->item.flags = IV_WORK_ITEM_FLAG_INLINE_COMPLETION;
+		job->tid = main_tid;
+		job->count = NULL;
+
+		IV_EVENT_INIT(&job->ev);
+		job->ev.cookie = job;
+		job->ev.handler = got_inline_done;
+		iv_event_register(&job->ev);
+
+		iv_work_pool_submit_work(&pool, &job->item);
+	}
+
+	for (i = 0; i < NUM_THREADS; i++)
+		iv_thread_create("submitter", submitter, NULL);
+
+	iv_main();
+
+	iv_deinit();
+
+	printf("%d completions delivered to main thread\n", main_count);
+
+	return 0;
+}
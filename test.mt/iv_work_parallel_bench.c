@@ -0,0 +1,164 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iv.h>
+#include <iv_work.h>
+
+#define BLOCK_SIZE	4096
+#define NUM_BLOCKS	8192
+#define ITEM_BLOCKS	16
+#define NUM_ITEMS	(NUM_BLOCKS / ITEM_BLOCKS)
+
+static struct iv_work_pool pool;
+static unsigned char *buf;
+static uint32_t ref[NUM_BLOCKS];
+static uint32_t sum[NUM_BLOCKS];
+static struct iv_work_item items[NUM_ITEMS];
+static int items_done;
+static struct iv_work_parallel par;
+static long long t_start;
+static long long t_serial;
+static long long t_items;
+static long long t_parallel;
+
+static long long now_nsec(void)
+{
+	iv_invalidate_now();
+	iv_validate_now();
+
+	return 1000000000LL * iv_now.tv_sec + iv_now.tv_nsec;
+}
+
+static uint32_t checksum(const unsigned char *p)
+{
+	uint32_t a = 1;
+	uint32_t b = 0;
+	int i;
+
+	for (i = 0; i < BLOCK_SIZE; i++) {
+		a = (a + p[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+
+	return (b << 16) | a;
+}
+
+static void checksum_range(void *cookie, int start, int end)
+{
+	uint32_t *out = cookie;
+	int i;
+
+	for (i = start; i < end; i++)
+		out[i] = checksum(buf + (size_t)i * BLOCK_SIZE);
+}
+
+static void verify(const char *what)
+{
+	if (memcmp(ref, sum, sizeof(ref)))
+		iv_fatal("iv_work_parallel_bench: %s: checksum mismatch", what);
+	memset(sum, 0, sizeof(sum));
+}
+
+static void parallel_done(void *cookie)
+{
+	t_parallel = now_nsec() - t_start;
+	verify("parallel");
+
+	printf("serial:   %lld nsec\n", t_serial);
+	printf("items:    %lld nsec (%d items of %d blocks)\n",
+	       t_items, NUM_ITEMS, ITEM_BLOCKS);
+	printf("parallel: %lld nsec\n", t_parallel);
+
+	iv_work_pool_put(&pool);
+}
+
+static void item_work(void *cookie)
+{
+	int start = (struct iv_work_item *)cookie - items;
+
+	checksum_range(sum, start * ITEM_BLOCKS, (start + 1) * ITEM_BLOCKS);
+}
+
+static void item_done(void *cookie)
+{
+	if (++items_done < NUM_ITEMS)
+		return;
+
+	t_items = now_nsec() - t_start;
+	verify("items");
+
+	IV_WORK_PARALLEL_INIT(&par);
+	par.count = NUM_BLOCKS;
+	par.cookie = sum;
+	par.work = checksum_range;
+	par.completion = parallel_done;
+
+	t_start = now_nsec();
+	if (iv_work_pool_submit_parallel(&pool, &par) < 0)
+		iv_fatal("iv_work_parallel_bench: submit failed");
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	iv_init();
+
+	IV_WORK_POOL_INIT(&pool);
+	pool.max_threads = (argc > 1) ? atoi(argv[1]) : 4;
+	if (iv_work_pool_create(&pool) < 0)
+		iv_fatal("iv_work_parallel_bench: can't create pool");
+
+	buf = malloc((size_t)NUM_BLOCKS * BLOCK_SIZE);
+	if (buf == NULL)
+		iv_fatal("iv_work_parallel_bench: out of memory");
+
+	for (i = 0; i < NUM_BLOCKS * BLOCK_SIZE; i++)
+		buf[i] = i * 2654435761U >> 24;
+
+	t_start = now_nsec();
+	checksum_range(ref, 0, NUM_BLOCKS);
+	t_serial = now_nsec() - t_start;
+
+	/*
+	 * First do it the hand-rolled way, with one work item per
+	 * fixed-size slice and a completion counter.
+	 */
+	t_start = now_nsec();
+	for (i = 0; i < NUM_ITEMS; i++) {
+		IV_WORK_ITEM_INIT(&items[i]);
+		items[i].cookie = &items[i];
+		items[i].work = item_work;
+		items[i].completion = item_done;
+		iv_work_pool_submit_work(&pool, &items[i]);
+	}
+
+	iv_main();
+
+	iv_deinit();
+
+	free(buf);
+
+	return 0;
+}
@@ -0,0 +1,241 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iv.h>
+#include <iv_work.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#define NUM_THREADS	4
+#define NUM_ITEMS	16
+#define ITEM_MSEC	10
+
+#ifdef __linux__
+struct pin_pool {
+	struct iv_work_pool	pool;
+	char			*name;
+	cpu_set_t		expect;
+	int			must_pin;
+	int			completed;
+	struct job {
+		struct iv_work_item	item;
+		struct pin_pool		*pp;
+		cpu_set_t		mask;
+		int			cur;
+	} jobs[NUM_ITEMS];
+};
+
+static struct pin_pool cpu_pool;
+static struct pin_pool node_pool;
+static int completed;
+
+static void work(void *_job)
+{
+	struct job *job = _job;
+
+	sched_getaffinity(0, sizeof(job->mask), &job->mask);
+	usleep(1000 * ITEM_MSEC);
+	job->cur = sched_getcpu();
+}
+
+static void work_complete(void *_job)
+{
+	struct job *job = _job;
+	struct pin_pool *pp = job->pp;
+	int cpu;
+
+	completed++;
+
+	if (CPU_COUNT(&job->mask) != 1) {
+		/*
+		 * Pinning to a CPU outside of our cpuset fails, and is
+		 * not an error, so only complain if we picked the CPUs.
+		 */
+		if (pp->must_pin) {
+			iv_fatal("iv_work_pin_test: %s: thread is allowed "
+				 "to run on %d CPUs", pp->name,
+				 CPU_COUNT(&job->mask));
+		}
+	} else {
+		for (cpu = 0; !CPU_ISSET(cpu, &job->mask); cpu++)
+			;
+
+		if (!CPU_ISSET(cpu, &pp->expect)) {
+			iv_fatal("iv_work_pin_test: %s: thread pinned to "
+				 "unexpected CPU %d", pp->name, cpu);
+		}
+
+		if (job->cur >= 0 && job->cur != cpu) {
+			iv_fatal("iv_work_pin_test: %s: thread pinned to "
+				 "CPU %d ran on CPU %d", pp->name, cpu,
+				 job->cur);
+		}
+	}
+
+	if (++pp->completed == NUM_ITEMS)
+		iv_work_pool_put(&pp->pool);
+}
+
+static void submit_items(struct pin_pool *pp)
+{
+	int i;
+
+	for (i = 0; i < NUM_ITEMS; i++) {
+		struct job *job = &pp->jobs[i];
+
+		IV_WORK_ITEM_INIT(&job->item);
+		job->item.cookie = job;
+		job->item.work = work;
+		job->item.completion = work_complete;
+		job->pp = pp;
+		iv_work_pool_submit_work(&pp->pool, &job->item);
+	}
+}
+
+static void pin_pool_init(struct pin_pool *pp, char *name)
+{
+	IV_WORK_POOL_INIT(&pp->pool);
+	pp->pool.max_threads = NUM_THREADS;
+#ifdef LIGHTWEIGHT
+	pp->pool.flags = IV_WORK_POOL_FLAG_LIGHTWEIGHT;
+#endif
+	pp->name = name;
+	CPU_ZERO(&pp->expect);
+}
+
+static int read_node_cpus(int node, cpu_set_t *set)
+{
+	char path[256];
+	FILE *fp;
+	int a;
+	int b;
+	int c;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/node/node%d/cpulist", node);
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+
+	CPU_ZERO(set);
+	while (fscanf(fp, "%d", &a) == 1) {
+		b = a;
+		c = fgetc(fp);
+		if (c == '-') {
+			if (fscanf(fp, "%d", &b) != 1)
+				break;
+			c = fgetc(fp);
+		}
+
+		while (a <= b && a < CPU_SETSIZE)
+			CPU_SET(a++, set);
+
+		if (c != ',')
+			break;
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+int main()
+{
+	cpu_set_t allowed;
+	int cpus[NUM_THREADS];
+	int num_cpus;
+	cpu_set_t node_cpus;
+	struct iv_work_pool bogus_pool;
+	int cpu;
+
+	iv_init();
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+		perror("sched_getaffinity");
+		return 1;
+	}
+
+	/*
+	 * Pin to (at most) the first NUM_THREADS CPUs we are allowed
+	 * to run on, so that this test also works on uniprocessors and
+	 * inside restricted cpusets.
+	 */
+	pin_pool_init(&cpu_pool, "cpus");
+	num_cpus = 0;
+	for (cpu = 0; cpu < CPU_SETSIZE && num_cpus < NUM_THREADS; cpu++) {
+		if (CPU_ISSET(cpu, &allowed)) {
+			cpus[num_cpus++] = cpu;
+			CPU_SET(cpu, &cpu_pool.expect);
+		}
+	}
+	cpu_pool.pool.cpus = cpus;
+	cpu_pool.pool.num_cpus = num_cpus;
+	cpu_pool.must_pin = 1;
+	if (iv_work_pool_create(&cpu_pool.pool) < 0)
+		iv_fatal("iv_work_pin_test: can't create CPU pinned pool");
+	submit_items(&cpu_pool);
+
+	/*
+	 * Node 0 exists on every NUMA-enabled Linux host.  On hosts
+	 * without NUMA support, asking for a NUMA node has to fail.
+	 */
+	pin_pool_init(&node_pool, "node 0");
+	node_pool.pool.numa_node = 0;
+	if (read_node_cpus(0, &node_cpus) == 0) {
+		CPU_AND(&node_pool.expect, &node_cpus, &allowed);
+		if (iv_work_pool_create(&node_pool.pool) < 0)
+			iv_fatal("iv_work_pin_test: can't create node pool");
+		submit_items(&node_pool);
+	} else {
+		if (iv_work_pool_create(&node_pool.pool) == 0)
+			iv_fatal("iv_work_pin_test: created node pool on a "
+				 "host without NUMA support");
+		printf("no NUMA support, skipping node pinning\n");
+	}
+
+	/*
+	 * A node that doesn't exist should always be refused.
+	 */
+	IV_WORK_POOL_INIT(&bogus_pool);
+	bogus_pool.numa_node = 1 << 20;
+	if (iv_work_pool_create(&bogus_pool) == 0)
+		iv_fatal("iv_work_pin_test: created pool on bogus node");
+
+	iv_main();
+
+	iv_deinit();
+
+	printf("%d work items completed\n", completed);
+
+	return 0;
+}
+#else
+int main()
+{
+	printf("CPU pinning not supported, skipping\n");
+
+	return 0;
+}
+#endif
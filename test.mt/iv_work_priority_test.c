@@ -0,0 +1,127 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iv.h>
+#include <iv_work.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#define NUM_ITEMS	10
+
+struct job {
+	struct iv_work_item	item;
+	int			ran;
+};
+
+static struct iv_work_pool pool;
+static struct job blocker;
+static struct job jobs[2 * NUM_ITEMS];
+static struct job expired;
+static int run_count;
+static int jobs_done;
+
+static void work(void *_job)
+{
+	struct job *job = _job;
+
+	if (job == &blocker) {
+#ifndef _WIN32
+		usleep(200000);
+#else
+		Sleep(200);
+#endif
+	}
+
+	job->ran = ++run_count;
+}
+
+static void work_complete(void *_job)
+{
+	int i;
+
+	if (++jobs_done < 2 * NUM_ITEMS + 2)
+		return;
+
+	if (!expired.item.timed_out || expired.ran)
+		iv_fatal("iv_work_priority_test: expired item was run");
+
+	for (i = 0; i < 2 * NUM_ITEMS; i++) {
+		if (jobs[i].item.timed_out)
+			iv_fatal("iv_work_priority_test: item %d timed out", i);
+
+		if (jobs[i].item.priority && jobs[i].ran > NUM_ITEMS + 1) {
+			iv_fatal("iv_work_priority_test: high priority item "
+				 "%d ran as number %d", i, jobs[i].ran);
+		}
+	}
+
+	iv_work_pool_put(&pool);
+}
+
+static void submit(struct job *job, int priority)
+{
+	IV_WORK_ITEM_INIT(&job->item);
+	job->item.cookie = job;
+	job->item.work = work;
+	job->item.completion = work_complete;
+	job->item.priority = priority;
+	job->ran = 0;
+
+	iv_work_pool_submit_work(&pool, &job->item);
+}
+
+int main()
+{
+	int i;
+
+	iv_init();
+
+	IV_WORK_POOL_INIT(&pool);
+	pool.max_threads = 1;
+	iv_work_pool_create(&pool);
+
+	/*
+	 * Keep the single pool thread busy while the other work items
+	 * are being queued up behind it.
+	 */
+	submit(&blocker, 20);
+
+	for (i = 0; i < 2 * NUM_ITEMS; i++)
+		submit(&jobs[i], (i & 1) ? 10 : 0);
+
+	IV_WORK_ITEM_INIT(&expired.item);
+	expired.item.cookie = &expired;
+	expired.item.work = work;
+	expired.item.completion = work_complete;
+	expired.item.deadline.tv_nsec = 1;
+	expired.ran = 0;
+	iv_work_pool_submit_work(&pool, &expired.item);
+
+	iv_main();
+
+	iv_deinit();
+
+	printf("%d work items completed\n", jobs_done);
+
+	return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iv.h>
+#include <iv_event.h>
+#include <iv_work.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#define NUM_THREADS	4
+#define NUM_ITEMS	40
+#define MAX_WAIT_MSEC	10000
+
+static struct iv_work_pool pool;
+static struct iv_event started;
+static struct iv_work_item blocker;
+static struct iv_work_item items[NUM_ITEMS];
+static volatile int others_done;
+static int stuck;
+static int completed;
+
+static void sleep_msec(int msec)
+{
+#ifndef _WIN32
+	usleep(msec * 1000);
+#else
+	Sleep(msec);
+#endif
+}
+
+/*
+ * The blocker is the first item to be submitted, and so it lands on
+ * the queue of the first pool thread, which will be busy running it
+ * while every NUM_THREADS'th of the other items is queued up behind
+ * it.  It doesn't return until all other items have completed, which
+ * can only happen if the other threads steal those items.
+ */
+static void work(void *_item)
+{
+	int i;
+
+	if (_item != &blocker)
+		return;
+
+	iv_event_post(&started);
+
+	for (i = 0; !others_done; i++) {
+		if (i == MAX_WAIT_MSEC) {
+			stuck = 1;
+			break;
+		}
+		sleep_msec(1);
+	}
+}
+
+static void work_complete(void *_item)
+{
+	completed++;
+
+	if (_item != &blocker) {
+		if (completed == NUM_ITEMS)
+			others_done = 1;
+		return;
+	}
+
+	if (stuck) {
+		iv_fatal("iv_work_steal_test: items queued behind a busy "
+			 "thread were not stolen (%d of %d completed)",
+			 completed - 1, NUM_ITEMS);
+	}
+
+	iv_work_pool_put(&pool);
+}
+
+static void got_started(void *_dummy)
+{
+	int i;
+
+	iv_event_unregister(&started);
+
+	for (i = 0; i < NUM_ITEMS; i++) {
+		IV_WORK_ITEM_INIT(&items[i]);
+		items[i].cookie = &items[i];
+		items[i].work = work;
+		items[i].completion = work_complete;
+		iv_work_pool_submit_work(&pool, &items[i]);
+	}
+}
+
+int main()
+{
+	iv_init();
+
+	IV_WORK_POOL_INIT(&pool);
+	pool.max_threads = NUM_THREADS;
+	iv_work_pool_create(&pool);
+
+	IV_EVENT_INIT(&started);
+	started.handler = got_started;
+	iv_event_register(&started);
+
+	IV_WORK_ITEM_INIT(&blocker);
+	blocker.cookie = &blocker;
+	blocker.work = work;
+	blocker.completion = work_complete;
+	iv_work_pool_submit_work(&pool, &blocker);
+
+	iv_main();
+
+	iv_deinit();
+
+	printf("%d work items completed\n", completed);
+
+	return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iv.h>
+#include <iv_work.h>
+
+#define NUM_STRANDS	4
+#define NUM_ITEMS	10000
+
+struct job {
+	struct iv_work_item	item;
+	int			strand;
+	int			seq;
+};
+
+static struct iv_work_pool pool;
+static struct iv_work_strand strands[NUM_STRANDS];
+static struct job jobs[NUM_STRANDS * NUM_ITEMS];
+static int busy[NUM_STRANDS];
+static int next_run[NUM_STRANDS];
+static int next_done[NUM_STRANDS];
+static int jobs_done;
+
+static void work(void *_job)
+{
+	struct job *job = _job;
+
+	if (busy[job->strand]) {
+		iv_fatal("iv_work_strand_test: strand %d is running two "
+			 "work items at once", job->strand);
+	}
+	busy[job->strand] = 1;
+
+	if (job->seq != next_run[job->strand]) {
+		iv_fatal("iv_work_strand_test: strand %d ran %d, "
+			 "expected %d", job->strand, job->seq,
+			 next_run[job->strand]);
+	}
+	next_run[job->strand]++;
+
+	busy[job->strand] = 0;
+}
+
+static void work_complete(void *_job)
+{
+	struct job *job = _job;
+	int i;
+
+	if (job->seq != next_done[job->strand]) {
+		iv_fatal("iv_work_strand_test: strand %d completed %d, "
+			 "expected %d", job->strand, job->seq,
+			 next_done[job->strand]);
+	}
+	next_done[job->strand]++;
+
+	if (++jobs_done == NUM_STRANDS * NUM_ITEMS) {
+		for (i = 0; i < NUM_STRANDS; i++)
+			iv_work_strand_put(&strands[i]);
+		iv_work_pool_put(&pool);
+	}
+}
+
+int main()
+{
+	int i;
+
+	iv_init();
+
+	IV_WORK_POOL_INIT(&pool);
+	pool.max_threads = 4;
+	iv_work_pool_create(&pool);
+
+	for (i = 0; i < NUM_STRANDS; i++) {
+		IV_WORK_STRAND_INIT(&strands[i]);
+		strands[i].pool = &pool;
+		iv_work_strand_create(&strands[i]);
+	}
+
+	for (i = 0; i < NUM_STRANDS * NUM_ITEMS; i++) {
+		struct job *job = &jobs[i];
+
+		IV_WORK_ITEM_INIT(&job->item);
+		job->item.cookie = job;
+		job->item.work = work;
+		job->item.completion = work_complete;
+		job->strand = i % NUM_STRANDS;
+		job->seq = i / NUM_STRANDS;
+
+		iv_work_strand_submit(&strands[job->strand], &job->item);
+	}
+
+	iv_main();
+
+	iv_deinit();
+
+	printf("%d work items completed\n", jobs_done);
+
+	return 0;
+}
@@ -66,6 +66,9 @@ int main()
 
 	IV_WORK_POOL_INIT(&pool);
 	pool.max_threads = 8;
+#ifdef LIGHTWEIGHT
+	pool.flags = IV_WORK_POOL_FLAG_LIGHTWEIGHT;
+#endif
 	iv_work_pool_create(&pool);
 
 	IV_WORK_ITEM_INIT(&item_a);
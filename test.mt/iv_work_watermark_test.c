@@ -0,0 +1,144 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iv.h>
+#include <iv_event.h>
+#include <iv_work.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#define HIGH_WATERMARK	8
+#define LOW_WATERMARK	2
+#define NUM_ITEMS	20
+
+static struct iv_work_pool pool;
+static struct iv_event started;
+static struct iv_work_item blocker;
+static struct iv_work_item items[NUM_ITEMS];
+static int submitted;
+static int completed;
+static int full_calls;
+static int drained_calls;
+static int full_at;
+
+static void work(void *_item)
+{
+	if (_item == &blocker) {
+		iv_event_post(&started);
+#ifndef _WIN32
+		usleep(200000);
+#else
+		Sleep(200);
+#endif
+	} else {
+#ifndef _WIN32
+		usleep(1000);
+#else
+		Sleep(1);
+#endif
+	}
+}
+
+static void work_complete(void *_item)
+{
+	if (++completed < NUM_ITEMS + 1)
+		return;
+
+	if (full_calls != 1 || full_at != HIGH_WATERMARK) {
+		iv_fatal("iv_work_watermark_test: queue_full called %d "
+			 "times, at depth %d", full_calls, full_at);
+	}
+
+	if (drained_calls != 1) {
+		iv_fatal("iv_work_watermark_test: queue_drained called %d "
+			 "times", drained_calls);
+	}
+
+	iv_work_pool_put(&pool);
+}
+
+static void queue_full(void *cookie)
+{
+	full_calls++;
+	full_at = submitted;
+}
+
+static void queue_drained(void *cookie)
+{
+	if (!full_calls)
+		iv_fatal("iv_work_watermark_test: drained before full");
+
+	drained_calls++;
+}
+
+static void got_started(void *_dummy)
+{
+	int i;
+
+	iv_event_unregister(&started);
+
+	/*
+	 * The single pool thread is busy running the blocker, so the
+	 * queue depth is exactly the number of items submitted so far.
+	 */
+	for (i = 0; i < NUM_ITEMS; i++) {
+		IV_WORK_ITEM_INIT(&items[i]);
+		items[i].cookie = &items[i];
+		items[i].work = work;
+		items[i].completion = work_complete;
+
+		submitted++;
+		iv_work_pool_submit_work(&pool, &items[i]);
+	}
+}
+
+int main()
+{
+	iv_init();
+
+	IV_WORK_POOL_INIT(&pool);
+	pool.max_threads = 1;
+	pool.high_watermark = HIGH_WATERMARK;
+	pool.low_watermark = LOW_WATERMARK;
+	pool.queue_full = queue_full;
+	pool.queue_drained = queue_drained;
+	iv_work_pool_create(&pool);
+
+	IV_EVENT_INIT(&started);
+	started.handler = got_started;
+	iv_event_register(&started);
+
+	IV_WORK_ITEM_INIT(&blocker);
+	blocker.cookie = &blocker;
+	blocker.work = work;
+	blocker.completion = work_complete;
+	iv_work_pool_submit_work(&pool, &blocker);
+
+	iv_main();
+
+	iv_deinit();
+
+	printf("%d work items completed\n", completed);
+
+	return 0;
+}
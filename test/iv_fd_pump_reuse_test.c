@@ -0,0 +1,291 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iv.h>
+#include <iv_fd_pump.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef F_SETPIPE_SZ
+#define MAX_FDS		1024
+#define CHUNK		16384
+#define BIG_PIPE	262144
+
+static void set_bands(void *cookie, int pollin, int pollout)
+{
+}
+
+static unsigned char pattern(int off)
+{
+	return (off * 7 + off / 251) & 0xff;
+}
+
+static void snapshot(char *open_fds)
+{
+	int i;
+
+	for (i = 0; i < MAX_FDS; i++)
+		open_fds[i] = (fcntl(i, F_GETFD) >= 0);
+}
+
+static int count_fds(void)
+{
+	char open_fds[MAX_FDS];
+	int count;
+	int i;
+
+	snapshot(open_fds);
+
+	count = 0;
+	for (i = 0; i < MAX_FDS; i++)
+		count += open_fds[i];
+
+	return count;
+}
+
+static void nonblock(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+/*
+ * Set up a pump from a socket holding CHUNK bytes of test data to
+ * the write end of a pipe, and return the read end of that pipe.
+ */
+static int setup_pump(struct iv_fd_pump *ip, int *in, int buf_size)
+{
+	unsigned char buf[CHUNK];
+	int sp[2];
+	int pfd[2];
+	int i;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sp) < 0 || pipe(pfd) < 0) {
+		perror("socketpair/pipe");
+		exit(1);
+	}
+
+	for (i = 0; i < CHUNK; i++)
+		buf[i] = pattern(i);
+
+	if (write(sp[0], buf, CHUNK) != CHUNK) {
+		perror("write");
+		exit(1);
+	}
+
+	nonblock(sp[1]);
+	nonblock(pfd[1]);
+	*in = sp[0];
+
+	IV_FD_PUMP_INIT(ip);
+	ip->from_fd = sp[1];
+	ip->to_fd = pfd[1];
+	ip->set_bands = set_bands;
+	ip->flags = 0;
+	ip->buf_size = buf_size;
+	iv_fd_pump_init(ip);
+
+	return pfd[0];
+}
+
+static void teardown_pump(struct iv_fd_pump *ip, int in, int out)
+{
+	iv_fd_pump_destroy(ip);
+	close(ip->from_fd);
+	close(ip->to_fd);
+	close(in);
+	close(out);
+}
+
+/*
+ * A pipe that is handed back while it still holds data should be
+ * drained and kept in the cache, and the next pump that picks it up
+ * must not see any of the old data.
+ */
+static int test_reuse(void)
+{
+	struct iv_fd_pump ip;
+	unsigned char buf[CHUNK];
+	int before;
+	int in;
+	int out;
+	int got;
+	int i;
+
+	before = count_fds();
+
+	/*
+	 * Fill up the output pipe first, so that all data read by the
+	 * pump stays in its pipe.
+	 */
+	out = setup_pump(&ip, &in, 0);
+	memset(buf, 0, sizeof(buf));
+	while (write(ip.to_fd, buf, sizeof(buf)) > 0)
+		;
+	if (iv_fd_pump_pump(&ip) < 0) {
+		perror("iv_fd_pump_pump");
+		return 1;
+	}
+	teardown_pump(&ip, in, out);
+
+	if (count_fds() != before) {
+		fprintf(stderr, "iv_fd_pump_reuse_test: %d fds open before, "
+				"%d after destroying a pump with data in "
+				"its pipe\n", before, count_fds());
+		return 1;
+	}
+
+	out = setup_pump(&ip, &in, 0);
+	nonblock(out);
+
+	got = 0;
+	for (i = 0; got < CHUNK && i < 1000; i++) {
+		int ret;
+
+		if (iv_fd_pump_pump(&ip) < 0) {
+			perror("iv_fd_pump_pump");
+			return 1;
+		}
+
+		ret = read(out, buf + got, CHUNK - got);
+		if (ret > 0)
+			got += ret;
+	}
+
+	if (count_fds() != before + 4) {
+		fprintf(stderr, "iv_fd_pump_reuse_test: second pump "
+				"allocated a new pipe\n");
+		return 1;
+	}
+
+	teardown_pump(&ip, in, out);
+
+	if (got != CHUNK) {
+		fprintf(stderr, "iv_fd_pump_reuse_test: got %d of %d "
+				"bytes\n", got, CHUNK);
+		return 1;
+	}
+
+	for (i = 0; i < CHUNK; i++) {
+		if (buf[i] != pattern(i)) {
+			fprintf(stderr, "iv_fd_pump_reuse_test: data "
+					"mismatch at offset %d\n", i);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * A non-default ->buf_size should be applied to newly created pipes.
+ */
+static int test_pipe_size(void)
+{
+	struct iv_fd_pump ip;
+	char before[MAX_FDS];
+	char after[MAX_FDS];
+	FILE *fp;
+	int max;
+	int in;
+	int out;
+	int i;
+
+	max = 0;
+	fp = fopen("/proc/sys/fs/pipe-max-size", "r");
+	if (fp != NULL) {
+		if (fscanf(fp, "%d", &max) != 1)
+			max = 0;
+		fclose(fp);
+	}
+
+	if (max < BIG_PIPE) {
+		printf("pipe-max-size too small, skipping pipe size test\n");
+		return 0;
+	}
+
+	out = setup_pump(&ip, &in, BIG_PIPE);
+	snapshot(before);
+	if (iv_fd_pump_pump(&ip) < 0) {
+		perror("iv_fd_pump_pump");
+		return 1;
+	}
+	snapshot(after);
+
+	for (i = 0; i < MAX_FDS; i++) {
+		int size;
+
+		if (before[i] || !after[i])
+			continue;
+
+		size = fcntl(i, F_GETPIPE_SZ);
+		if (size != BIG_PIPE) {
+			fprintf(stderr, "iv_fd_pump_reuse_test: pipe size "
+					"%d, expected %d\n", size, BIG_PIPE);
+			return 1;
+		}
+	}
+
+	teardown_pump(&ip, in, out);
+
+	return 0;
+}
+
+int main()
+{
+	struct iv_fd_pump ip;
+	int before;
+	int in;
+	int out;
+	int ret;
+
+	iv_init();
+
+	/*
+	 * The first pump initialisation checks whether splice(2)
+	 * works, which leaves pipes in the cache if it does.
+	 */
+	before = count_fds();
+	out = setup_pump(&ip, &in, 0);
+	teardown_pump(&ip, in, out);
+
+	if (count_fds() == before) {
+		printf("splice not available, skipping\n");
+		iv_deinit();
+		return 0;
+	}
+
+	ret = test_reuse() || test_pipe_size();
+
+	iv_deinit();
+
+	return ret;
+}
+#else
+int main()
+{
+	printf("F_SETPIPE_SZ not available, skipping\n");
+
+	return 0;
+}
+#endif
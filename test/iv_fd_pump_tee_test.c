@@ -0,0 +1,224 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iv.h>
+#include <iv_fd_pump.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TOTAL_BYTES	(4 * 1048576)
+#define NUM_READERS	3
+
+/*
+ * The last sink is never read from, so it should be dropped once
+ * it holds the other sinks up for longer than MAX_LAG_MSEC.
+ */
+#define NUM_SINKS	(NUM_READERS + 1)
+#define MAX_LAG_MSEC	100
+
+static struct iv_fd writer;
+static struct iv_fd tee_in;
+static struct iv_fd tee_out[NUM_SINKS];
+static struct iv_fd reader[NUM_READERS];
+static struct iv_fd_pump_tee_sink sinks[NUM_SINKS];
+static struct iv_fd_pump_tee tee;
+static int written;
+static int verified[NUM_READERS];
+static int readers_done;
+static int dropped;
+
+static unsigned char pattern(int off)
+{
+	return (off * 7 + off / 251) & 0xff;
+}
+
+static void got_writer_out(void *_dummy)
+{
+	unsigned char buf[8192];
+	int len;
+	int i;
+	int ret;
+
+	len = TOTAL_BYTES - written;
+	if (len > sizeof(buf))
+		len = sizeof(buf);
+
+	for (i = 0; i < len; i++)
+		buf[i] = pattern(written + i);
+
+	ret = write(writer.fd, buf, len);
+	if (ret <= 0)
+		return;
+
+	written += ret;
+	if (written == TOTAL_BYTES) {
+		shutdown(writer.fd, SHUT_WR);
+		iv_fd_set_handler_out(&writer, NULL);
+	}
+}
+
+static void do_pump(void *_dummy)
+{
+	int ret;
+	int i;
+
+	ret = iv_fd_pump_tee_pump(&tee);
+	if (ret < 0) {
+		fprintf(stderr, "iv_fd_pump_tee_test: pump error\n");
+		exit(1);
+	}
+
+	if (ret == 0) {
+		iv_fd_pump_tee_destroy(&tee);
+		iv_fd_unregister(&tee_in);
+		for (i = 0; i < NUM_SINKS; i++)
+			iv_fd_unregister(&tee_out[i]);
+	}
+}
+
+static void set_pollin(void *cookie, int pollin)
+{
+	iv_fd_set_handler_in(&tee_in, pollin ? do_pump : NULL);
+}
+
+static void set_pollout(void *cookie, int pollout)
+{
+	struct iv_fd *fd = cookie;
+
+	iv_fd_set_handler_out(fd, pollout ? do_pump : NULL);
+}
+
+static void sink_dropped(void *cookie)
+{
+	if (cookie != &tee_out[NUM_SINKS - 1]) {
+		fprintf(stderr, "iv_fd_pump_tee_test: wrong sink dropped\n");
+		exit(1);
+	}
+	dropped++;
+}
+
+static void got_reader_in(void *_i)
+{
+	int i = (int)(long)_i;
+	unsigned char buf[8192];
+	int ret;
+	int j;
+
+	ret = read(reader[i].fd, buf, sizeof(buf));
+	if (ret < 0)
+		return;
+
+	if (ret == 0) {
+		if (verified[i] != TOTAL_BYTES) {
+			fprintf(stderr, "iv_fd_pump_tee_test: reader %d got "
+					"%d bytes\n", i, verified[i]);
+			exit(1);
+		}
+
+		iv_fd_unregister(&reader[i]);
+		if (++readers_done == NUM_READERS)
+			iv_fd_unregister(&writer);
+		return;
+	}
+
+	for (j = 0; j < ret; j++) {
+		if (buf[j] != pattern(verified[i] + j)) {
+			fprintf(stderr, "iv_fd_pump_tee_test: data mismatch "
+					"at offset %d\n", verified[i] + j);
+			exit(1);
+		}
+	}
+	verified[i] += ret;
+}
+
+static void register_fd(struct iv_fd *fd, int sock)
+{
+	IV_FD_INIT(fd);
+	fd->fd = sock;
+	iv_fd_register(fd);
+}
+
+int main(int argc, char *argv[])
+{
+	int fd[2];
+	int i;
+
+	alarm(30);
+
+#ifdef NO_SPLICE
+	setenv("IV_FD_PUMP_NO_SPLICE", "1", 1);
+#endif
+
+	iv_init();
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	register_fd(&writer, fd[0]);
+	iv_fd_set_handler_out(&writer, got_writer_out);
+
+	register_fd(&tee_in, fd[1]);
+
+	for (i = 0; i < NUM_SINKS; i++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0) {
+			perror("socketpair");
+			return 1;
+		}
+
+		register_fd(&tee_out[i], fd[0]);
+
+		if (i < NUM_READERS) {
+			register_fd(&reader[i], fd[1]);
+			reader[i].cookie = (void *)(long)i;
+			iv_fd_set_handler_in(&reader[i], got_reader_in);
+		}
+
+		sinks[i].fd = fd[0];
+		sinks[i].cookie = &tee_out[i];
+		sinks[i].set_pollout = set_pollout;
+		sinks[i].dropped = sink_dropped;
+	}
+
+	IV_FD_PUMP_TEE_INIT(&tee);
+	tee.from_fd = tee_in.fd;
+	tee.set_pollin = set_pollin;
+	tee.flags = IV_FD_PUMP_FLAG_RELAY_EOF;
+	tee.buf_size = 16384;
+	tee.max_lag_msec = MAX_LAG_MSEC;
+	tee.sinks = sinks;
+	tee.num_sinks = NUM_SINKS;
+	iv_fd_pump_tee_init(&tee);
+
+	iv_main();
+
+	iv_deinit();
+
+	if (dropped != 1) {
+		fprintf(stderr, "iv_fd_pump_tee_test: %d sinks dropped\n",
+			dropped);
+		return 1;
+	}
+
+	return 0;
+}
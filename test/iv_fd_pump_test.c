@@ -0,0 +1,355 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iv.h>
+#include <iv_fd_pump.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef ZEROCOPY
+#include <netinet/in.h>
+#endif
+
+#define TOTAL_BYTES	(4 * 1048576)
+#define MIN_BYTES_PER_CALL	256
+
+#ifndef FILE_SOURCE
+static struct iv_fd writer;
+static struct iv_fd pump_in;
+#endif
+static struct iv_fd pump_out;
+static struct iv_fd reader;
+static struct iv_fd_pump pump;
+#ifdef RATE_LIMIT
+static struct iv_fd_pump_group group;
+static int pump_calls;
+#endif
+static int written;
+static int verified;
+static int success;
+
+static unsigned char pattern(int off)
+{
+	return (off * 7 + off / 251) & 0xff;
+}
+
+#ifndef FILE_SOURCE
+static void got_writer_out(void *_dummy)
+{
+	unsigned char buf[8192];
+	int len;
+	int i;
+	int ret;
+
+	len = TOTAL_BYTES - written;
+	if (len > sizeof(buf))
+		len = sizeof(buf);
+
+	for (i = 0; i < len; i++)
+		buf[i] = pattern(written + i);
+
+	ret = write(writer.fd, buf, len);
+	if (ret <= 0)
+		return;
+
+	written += ret;
+	if (written == TOTAL_BYTES) {
+		shutdown(writer.fd, SHUT_WR);
+		iv_fd_set_handler_out(&writer, NULL);
+	}
+}
+#else
+static int create_source_file(void)
+{
+	char name[] = "/tmp/iv_fd_pump_test.XXXXXX";
+	unsigned char buf[8192];
+	int fd;
+	int i;
+
+	fd = mkstemp(name);
+	if (fd < 0) {
+		perror("mkstemp");
+		exit(1);
+	}
+	unlink(name);
+
+	while (written < TOTAL_BYTES) {
+		for (i = 0; i < sizeof(buf); i++)
+			buf[i] = pattern(written + i);
+
+		if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			perror("write");
+			exit(1);
+		}
+		written += sizeof(buf);
+	}
+
+	lseek(fd, 0, SEEK_SET);
+
+	return fd;
+}
+#endif
+
+static void do_pump(void *_dummy)
+{
+	int ret;
+
+#ifdef RATE_LIMIT
+	pump_calls++;
+#endif
+
+	ret = iv_fd_pump_pump(&pump);
+	if (ret < 0) {
+		fprintf(stderr, "iv_fd_pump_test: pump error\n");
+		exit(1);
+	}
+
+	if (ret == 0) {
+		iv_fd_pump_destroy(&pump);
+#ifndef FILE_SOURCE
+		iv_fd_unregister(&pump_in);
+#endif
+		iv_fd_unregister(&pump_out);
+	}
+}
+
+static void set_bands(void *cookie, int pollin, int pollout)
+{
+#ifndef FILE_SOURCE
+	iv_fd_set_handler_in(&pump_in, pollin ? do_pump : NULL);
+#else
+	if (pollin) {
+		fprintf(stderr, "iv_fd_pump_test: input wanted on file\n");
+		exit(1);
+	}
+#endif
+	iv_fd_set_handler_out(&pump_out, pollout ? do_pump : NULL);
+}
+
+static void got_reader_in(void *_dummy)
+{
+	unsigned char buf[8192];
+	int ret;
+	int i;
+
+	ret = read(reader.fd, buf, sizeof(buf));
+	if (ret < 0)
+		return;
+
+	if (ret == 0) {
+		success = (verified == TOTAL_BYTES);
+		iv_fd_unregister(&reader);
+#ifndef FILE_SOURCE
+		iv_fd_unregister(&writer);
+#endif
+		return;
+	}
+
+	for (i = 0; i < ret; i++) {
+		if (buf[i] != pattern(verified + i)) {
+			fprintf(stderr, "iv_fd_pump_test: data mismatch at "
+					"offset %d\n", verified + i);
+			exit(1);
+		}
+	}
+	verified += ret;
+}
+
+#ifdef ZEROCOPY
+/*
+ * MSG_ZEROCOPY is only supported on TCP and UDP sockets, so
+ * use a TCP connection over the loopback interface.
+ */
+static int tcp_pair(int *fd)
+{
+	struct sockaddr_in addr;
+	socklen_t addrlen;
+	int lsock;
+
+	lsock = socket(AF_INET, SOCK_STREAM, 0);
+	if (lsock < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+
+	addrlen = sizeof(addr);
+	if (bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(lsock, 1) < 0 ||
+	    getsockname(lsock, (struct sockaddr *)&addr, &addrlen) < 0) {
+		close(lsock);
+		return -1;
+	}
+
+	fd[0] = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd[0] < 0 ||
+	    connect(fd[0], (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(lsock);
+		return -1;
+	}
+
+	fd[1] = accept(lsock, NULL, NULL);
+	close(lsock);
+
+	return (fd[1] < 0) ? -1 : 0;
+}
+#endif
+
+static void register_fd(struct iv_fd *fd, int sock)
+{
+	IV_FD_INIT(fd);
+	fd->fd = sock;
+	iv_fd_register(fd);
+}
+
+int main(int argc, char *argv[])
+{
+	struct iv_fd_pump_stats stats;
+	int src[2];
+	int dst[2];
+#ifdef RATE_LIMIT
+	struct timespec start;
+	struct timespec end;
+	double secs;
+#endif
+
+	alarm(30);
+
+	iv_init();
+
+#ifndef FILE_SOURCE
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, src) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	register_fd(&writer, src[0]);
+	iv_fd_set_handler_out(&writer, got_writer_out);
+
+	register_fd(&pump_in, src[1]);
+#else
+	/*
+	 * Regular files can't be polled, and the pump is expected
+	 * to only ever ask for output readiness.
+	 */
+	src[1] = create_source_file();
+#endif
+
+#ifndef ZEROCOPY
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, dst) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+#else
+	if (tcp_pair(dst) < 0) {
+		perror("tcp_pair");
+		return 1;
+	}
+#endif
+
+	register_fd(&pump_out, dst[0]);
+#ifdef ZEROCOPY
+	/*
+	 * Send completions are signaled as error conditions.
+	 */
+	iv_fd_set_handler_err(&pump_out, do_pump);
+#endif
+
+	register_fd(&reader, dst[1]);
+	iv_fd_set_handler_in(&reader, got_reader_in);
+
+	/*
+	 * Use a buffer size that doesn't divide the amount of data
+	 * being moved, so that the data wraps around the end of the
+	 * buffer at varying offsets if we are not splicing.
+	 */
+	IV_FD_PUMP_INIT(&pump);
+	pump.from_fd = src[1];
+	pump.to_fd = dst[0];
+	pump.set_bands = set_bands;
+	pump.flags = IV_FD_PUMP_FLAG_RELAY_EOF;
+#ifdef ZEROCOPY
+	pump.flags |= IV_FD_PUMP_FLAG_ZEROCOPY;
+#endif
+	pump.buf_size = 1000;
+#ifdef RATE_LIMIT
+	/*
+	 * The group limit is the tighter one, so after the first
+	 * MiB of burst, the remaining 3 MiB take at least 3/8 s.
+	 */
+	IV_FD_PUMP_GROUP_INIT(&group);
+	group.rate = 8 * 1048576;
+	group.burst = 1048576;
+	iv_fd_pump_group_init(&group);
+
+	pump.rate = 32 * 1048576;
+	pump.burst = 262144;
+	pump.group = &group;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
+	iv_fd_pump_init(&pump);
+
+	iv_main();
+
+	/*
+	 * The pump has been destroyed by now, and its counters
+	 * should have been added to the per-thread totals.
+	 */
+	iv_fd_pump_get_thread_stats(&stats);
+	if (stats.bytes_copied + stats.bytes_spliced != TOTAL_BYTES ||
+	    !stats.syscalls) {
+		fprintf(stderr, "iv_fd_pump_test: bogus statistics\n");
+		return 1;
+	}
+
+#ifdef RATE_LIMIT
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	iv_fd_pump_group_destroy(&group);
+
+	secs = (end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / 1e9;
+	if (secs < 0.3) {
+		fprintf(stderr, "iv_fd_pump_test: rate limit exceeded, "
+				"transfer took %.3f s\n", secs);
+		return 1;
+	}
+
+	/*
+	 * A throttled pump should wait for a useful amount of credit
+	 * to build up, rather than waking up to move a few bytes at a
+	 * time.
+	 */
+	if (pump_calls > TOTAL_BYTES / MIN_BYTES_PER_CALL) {
+		fprintf(stderr, "iv_fd_pump_test: %d pump calls for "
+				"%d bytes\n", pump_calls, TOTAL_BYTES);
+		return 1;
+	}
+#endif
+
+	iv_deinit();
+
+	return !success;
+}
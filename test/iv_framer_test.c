@@ -0,0 +1,268 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iv.h>
+#include <iv_framer.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define NUM_RECORDS	20000
+#define MAX_RECORD	300
+
+static struct iv_fd writer;
+static struct iv_framer fr;
+static unsigned char *stream;
+static int stream_len;
+static int written;
+static int verified;
+static int batched;
+static int done;
+
+static int record_len(int i)
+{
+	return (i * 37) % MAX_RECORD;
+}
+
+static unsigned char record_byte(int i, int j)
+{
+	return 'a' + (i + j) % 26;
+}
+
+/*
+ * Build the byte stream that the writer sends: either records that
+ * are each terminated by @delim (except for the last one, which the
+ * framer should deliver at end of file), or records that are each
+ * preceded by a two-byte length.
+ */
+static void build_stream(int type, unsigned char delim)
+{
+	int i;
+
+	stream = malloc(NUM_RECORDS * (MAX_RECORD + 2));
+	if (stream == NULL) {
+		fprintf(stderr, "iv_framer_test: out of memory\n");
+		exit(1);
+	}
+
+	stream_len = 0;
+	for (i = 0; i < NUM_RECORDS; i++) {
+		int len = record_len(i);
+		int j;
+
+		if (type == IV_FRAMER_TYPE_LENGTH) {
+			stream[stream_len++] = len >> 8;
+			stream[stream_len++] = len & 0xff;
+		}
+
+		for (j = 0; j < len; j++)
+			stream[stream_len++] = record_byte(i, j);
+
+		if (type == IV_FRAMER_TYPE_DELIM && i != NUM_RECORDS - 1)
+			stream[stream_len++] = delim;
+	}
+}
+
+static void got_writer_out(void *_dummy)
+{
+	int len;
+	int ret;
+
+	/*
+	 * Use an odd write size so that records end up being split
+	 * over reads at all possible offsets.
+	 */
+	len = stream_len - written;
+	if (len > 4093)
+		len = 4093;
+
+	ret = write(writer.fd, stream + written, len);
+	if (ret <= 0)
+		return;
+
+	written += ret;
+	if (written == stream_len) {
+		shutdown(writer.fd, SHUT_WR);
+		iv_fd_set_handler_out(&writer, NULL);
+	}
+}
+
+static void got_records(void *_dummy, const struct iv_framer_record *recs,
+			int num)
+{
+	int i;
+
+	if (num > 1)
+		batched = 1;
+
+	for (i = 0; i < num; i++) {
+		const unsigned char *data = recs[i].data;
+		int j;
+
+		if (verified == NUM_RECORDS ||
+		    recs[i].len != record_len(verified)) {
+			fprintf(stderr, "iv_framer_test: record %d has "
+					"length %d\n", verified,
+					(int)recs[i].len);
+			exit(1);
+		}
+
+		for (j = 0; j < recs[i].len; j++) {
+			if (data[j] != record_byte(verified, j)) {
+				fprintf(stderr, "iv_framer_test: data "
+						"mismatch in record %d\n",
+					verified);
+				exit(1);
+			}
+		}
+
+		verified++;
+	}
+}
+
+static void got_done(void *_dummy, int err)
+{
+	if (err) {
+		fprintf(stderr, "iv_framer_test: error %d\n", err);
+		exit(1);
+	}
+
+	done = 1;
+
+	iv_framer_unregister(&fr);
+	close(fr.fd);
+
+	iv_fd_unregister(&writer);
+	close(writer.fd);
+}
+
+static int run_test(int type, unsigned char delim)
+{
+	int fd[2];
+
+	build_stream(type, delim);
+	written = 0;
+	verified = 0;
+	batched = 0;
+	done = 0;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	IV_FD_INIT(&writer);
+	writer.fd = fd[0];
+	writer.handler_out = got_writer_out;
+	iv_fd_register(&writer);
+
+	IV_FRAMER_INIT(&fr);
+	fr.fd = fd[1];
+	fr.handler_records = got_records;
+	fr.handler_done = got_done;
+	fr.type = type;
+	fr.delim = delim;
+	fr.len_bytes = 2;
+	fr.buf_size = 8192;
+	iv_framer_register(&fr);
+
+	iv_main();
+
+	free(stream);
+
+	if (!done || verified != NUM_RECORDS || !batched) {
+		fprintf(stderr, "iv_framer_test: type %d delim %d: done %d, "
+				"verified %d, batched %d\n", type, delim,
+				done, verified, batched);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * The scan function is picked when the library is loaded, so run
+ * the tests again in a child process for each scan function that
+ * can be forced with IV_FRAMER_SCAN.  Those that are not available
+ * on this host fall back to the default one.
+ */
+static int run_scan_functions(char *argv0)
+{
+	static char *names[] = { "scalar", "sse2", "avx2", "neon" };
+	int i;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		pid_t pid;
+		int status;
+
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+
+		if (pid == 0) {
+			setenv("IV_FRAMER_SCAN", names[i], 1);
+			execl(argv0, argv0, (char *)NULL);
+			perror("execl");
+			_exit(1);
+		}
+
+		if (waitpid(pid, &status, 0) < 0) {
+			perror("waitpid");
+			return 1;
+		}
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "iv_framer_test: failed with "
+					"IV_FRAMER_SCAN=%s\n", names[i]);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	alarm(30);
+
+	iv_init();
+
+	ret = run_test(IV_FRAMER_TYPE_DELIM, '\n');
+	if (!ret)
+		ret = run_test(IV_FRAMER_TYPE_DELIM, '\0');
+	if (!ret)
+		ret = run_test(IV_FRAMER_TYPE_DELIM, 0xff);
+	if (!ret)
+		ret = run_test(IV_FRAMER_TYPE_LENGTH, '\n');
+
+	iv_deinit();
+
+	if (!ret && getenv("IV_FRAMER_SCAN") == NULL)
+		ret = run_scan_functions(argv[0]);
+
+	return ret;
+}
@@ -0,0 +1,273 @@
+/*
+ * ivykis, an event handling library
+ * Copyright (C) 2026 Lennert Buytenhek
+ * Dedicated to Marija Kulikova.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version
+ * 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License version 2.1 for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License version 2.1 along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street - Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <iv.h>
+#include <iv_stream.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TOTAL_BYTES	(4 * 1048576)
+#define BATCH		65536
+#define HIGH_WATER	(256 * 1024)
+#define LOW_WATER	(64 * 1024)
+#define SMALL_BYTES	8192
+
+static struct iv_stream st;
+static struct iv_task produce;
+static struct iv_fd reader;
+static int written;
+static int verified;
+static int full;
+static int full_calls;
+static int drained;
+static int errors;
+
+static unsigned char pattern(int off)
+{
+	return (off * 7 + off / 251) & 0xff;
+}
+
+/*
+ * Queue a batch of small records per event loop iteration, alternating
+ * between iv_stream_write and a two-element iv_stream_writev, until the
+ * stream says that its queue is full.  The reader drains the socket
+ * more slowly than that, so the stream will have to apply backpressure.
+ */
+static void got_produce(void *_dummy)
+{
+	int batch;
+
+	for (batch = 0; batch < BATCH && written < TOTAL_BYTES && !full; ) {
+		unsigned char buf[128];
+		int len;
+		int i;
+		int ret;
+
+		len = 1 + (written % 97);
+		if (len > TOTAL_BYTES - written)
+			len = TOTAL_BYTES - written;
+
+		for (i = 0; i < len; i++)
+			buf[i] = pattern(written + i);
+
+		if (written & 1) {
+			ret = iv_stream_write(&st, buf, len);
+		} else {
+			struct iovec iov[2];
+
+			iov[0].iov_base = buf;
+			iov[0].iov_len = len / 2;
+			iov[1].iov_base = buf + len / 2;
+			iov[1].iov_len = len - len / 2;
+			ret = iv_stream_writev(&st, iov, 2);
+		}
+
+		if (ret < 0) {
+			fprintf(stderr, "iv_stream_test: write failed\n");
+			exit(1);
+		}
+
+		written += len;
+		batch += len;
+	}
+
+	if (written < TOTAL_BYTES && !full)
+		iv_task_register(&produce);
+}
+
+static void got_full(void *_dummy)
+{
+	if (iv_stream_queued(&st) < HIGH_WATER) {
+		fprintf(stderr, "iv_stream_test: full at %d bytes\n",
+			(int)iv_stream_queued(&st));
+		exit(1);
+	}
+
+	full = 1;
+	full_calls++;
+}
+
+static void got_drained(void *_dummy)
+{
+	if (!full || iv_stream_queued(&st) > LOW_WATER) {
+		fprintf(stderr, "iv_stream_test: drained at %d bytes\n",
+			(int)iv_stream_queued(&st));
+		exit(1);
+	}
+
+	full = 0;
+	drained++;
+	if (written < TOTAL_BYTES && !iv_task_registered(&produce))
+		iv_task_register(&produce);
+}
+
+static void got_error(void *_dummy, int err)
+{
+	if (verified != TOTAL_BYTES) {
+		fprintf(stderr, "iv_stream_test: unexpected error %d\n", err);
+		exit(1);
+	}
+
+	errors++;
+	iv_stream_unregister(&st);
+}
+
+static void got_reader_in(void *_dummy)
+{
+	unsigned char buf[4096];
+	int ret;
+	int i;
+
+	ret = read(reader.fd, buf, sizeof(buf));
+	if (ret <= 0) {
+		if (ret < 0 && errno == EAGAIN)
+			return;
+		fprintf(stderr, "iv_stream_test: short stream\n");
+		exit(1);
+	}
+
+	for (i = 0; i < ret; i++) {
+		if (buf[i] != pattern(verified + i)) {
+			fprintf(stderr, "iv_stream_test: data mismatch "
+					"at offset %d\n", verified + i);
+			exit(1);
+		}
+	}
+	verified += ret;
+
+	/*
+	 * Once everything has arrived, hang up on the stream and make
+	 * sure that the next write to it reports an error.
+	 */
+	if (verified == TOTAL_BYTES) {
+		iv_fd_unregister(&reader);
+		close(reader.fd);
+
+		if (iv_stream_write(&st, buf, 1) < 0) {
+			fprintf(stderr, "iv_stream_test: write failed\n");
+			exit(1);
+		}
+	}
+}
+
+/*
+ * Without a high watermark, a producer that stops after queueing
+ * more than its own threshold relies on ->handler_drained to get
+ * going again, even if the kernel takes all of the data right away
+ * and the stream never has to wait for POLLOUT.
+ */
+static int small_drained;
+
+static void got_small_drained(void *_fd)
+{
+	int *fd = _fd;
+
+	small_drained++;
+
+	iv_stream_unregister(&st);
+	close(fd[0]);
+	close(fd[1]);
+}
+
+static int test_threshold(void)
+{
+	unsigned char buf[SMALL_BYTES];
+	int fd[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	IV_STREAM_INIT(&st);
+	st.fd = fd[0];
+	st.cookie = fd;
+	st.handler_drained = got_small_drained;
+	iv_stream_register(&st);
+
+	memset(buf, 0, sizeof(buf));
+	if (iv_stream_write(&st, buf, sizeof(buf)) < 0) {
+		fprintf(stderr, "iv_stream_test: write failed\n");
+		return 1;
+	}
+
+	iv_main();
+
+	if (small_drained != 1) {
+		fprintf(stderr, "iv_stream_test: handler_drained called "
+				"%d times\n", small_drained);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int fd[2];
+
+	alarm(30);
+
+	iv_init();
+
+	if (test_threshold())
+		return 1;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	IV_STREAM_INIT(&st);
+	st.fd = fd[0];
+	st.handler_full = got_full;
+	st.handler_drained = got_drained;
+	st.handler_error = got_error;
+	st.high_water = HIGH_WATER;
+	st.low_water = LOW_WATER;
+	iv_stream_register(&st);
+
+	IV_FD_INIT(&reader);
+	reader.fd = fd[1];
+	reader.handler_in = got_reader_in;
+	iv_fd_register(&reader);
+
+	IV_TASK_INIT(&produce);
+	produce.handler = got_produce;
+	iv_task_register(&produce);
+
+	iv_main();
+
+	iv_deinit();
+
+	if (verified != TOTAL_BYTES || !full_calls ||
+	    drained != full_calls || errors != 1) {
+		fprintf(stderr, "iv_stream_test: verified %d full %d "
+				"drained %d errors %d\n", verified,
+				full_calls, drained, errors);
+		return 1;
+	}
+
+	return 0;
+}